@@ -0,0 +1,123 @@
+; long arithmetic loops of add.asm, sub.asm and mul.asm as SysV-callable
+; functions, numbers are little-endian arrays of qwords
+
+                section         .text
+
+                global          bigint_add_n
+                global          bigint_sub_n
+                global          bigint_addmul_1
+                global          bigint_addmul_1_adx
+
+; adds two long numbers
+;    rdi -- address of result (long number, may be equal to rsi or rdx)
+;    rsi -- address of summand #1 (long number)
+;    rdx -- address of summand #2 (long number)
+;    rcx -- length of long numbers in qwords
+; result:
+;    sum is written to rdi
+;    rax -- carry out (0 or 1)
+bigint_add_n:
+                xor             eax, eax
+                test            rcx, rcx
+                jz              .done
+                clc
+.loop:
+                mov             r8, [rsi]
+                adc             r8, [rdx]
+                mov             [rdi], r8
+                lea             rsi, [rsi + 8]
+                lea             rdx, [rdx + 8]
+                lea             rdi, [rdi + 8]
+                dec             rcx
+                jnz             .loop
+
+                adc             eax, 0
+.done:
+                ret
+
+; subtracts two long numbers
+;    rdi -- address of result (long number, may be equal to rsi or rdx)
+;    rsi -- address of minuend (long number)
+;    rdx -- address of subtrahend (long number)
+;    rcx -- length of long numbers in qwords
+; result:
+;    difference is written to rdi
+;    rax -- borrow out (0 or 1)
+bigint_sub_n:
+                xor             eax, eax
+                test            rcx, rcx
+                jz              .done
+                clc
+.loop:
+                mov             r8, [rsi]
+                sbb             r8, [rdx]
+                mov             [rdi], r8
+                lea             rsi, [rsi + 8]
+                lea             rdx, [rdx + 8]
+                lea             rdi, [rdi + 8]
+                dec             rcx
+                jnz             .loop
+
+                adc             eax, 0
+.done:
+                ret
+
+; multiplies long number by a qword and adds the product to another one
+;    rdi -- address of accumulator (long number)
+;    rsi -- address of factor (long number)
+;    rdx -- length of long numbers in qwords
+;    rcx -- factor (64-bit unsigned)
+; result:
+;    sum is written to rdi
+;    rax -- high qword of the sum
+; additional registers:
+;    r9 - high bits from previous cycle
+bigint_addmul_1:
+                mov             r8, rdx
+                xor             r9, r9
+                test            r8, r8
+                jz              .done
+.loop:
+                mov             rax, [rsi]
+                mul             rcx
+                add             rax, r9
+                adc             rdx, 0
+                add             [rdi], rax
+                adc             rdx, 0
+                mov             r9, rdx
+                lea             rsi, [rsi + 8]
+                lea             rdi, [rdi + 8]
+                dec             r8
+                jnz             .loop
+.done:
+                mov             rax, r9
+                ret
+
+; same as bigint_addmul_1, requires BMI2 and ADX
+; mulx doesn't touch flags, so the accumulator and the high bits from
+; previous cycle are added in two independent carry chains: CF and OF
+; additional registers:
+;    r9 - high bits from previous cycle
+;    rcx - counter, changed only by lea to keep the flags
+bigint_addmul_1_adx:
+                xchg            rdx, rcx
+                xor             r9, r9
+.loop:
+                jrcxz           .done
+                mulx            r11, r10, [rsi]
+                adcx            r10, [rdi]
+                adox            r10, r9
+                mov             [rdi], r10
+                mov             r9, r11
+                lea             rsi, [rsi + 8]
+                lea             rdi, [rdi + 8]
+                lea             rcx, [rcx - 1]
+                jmp             .loop
+.done:
+                mov             eax, 0
+                adcx            r9, rax
+                adox            r9, rax
+                mov             rax, r9
+                ret
+
+                section         .note.GNU-stack noalloc noexec nowrite progbits
@@ -0,0 +1,107 @@
+#include "big_accumulator.h"
+
+#include <algorithm>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+big_accumulator::big_accumulator() = default;
+
+big_accumulator& big_accumulator::operator+=(const big_integer& rhs) {
+  absorb(rhs.sign ? negative : positive, rhs.data);
+  return *this;
+}
+
+big_accumulator& big_accumulator::operator-=(const big_integer& rhs) {
+  absorb(rhs.sign ? positive : negative, rhs.data);
+  return *this;
+}
+
+big_integer big_accumulator::value() const {
+  return fold(positive) - fold(negative);
+}
+
+void big_accumulator::clear() noexcept {
+  positive.clear();
+  negative.clear();
+  pending = 0;
+}
+
+void big_accumulator::absorb(std::vector<uint64_t>& lanes, const std::vector<uint32_t>& limbs) {
+  if (lanes.size() < limbs.size()) {
+    lanes.resize(limbs.size());
+  }
+  const uint32_t* src = limbs.data();
+  uint64_t* dst = lanes.data();
+  size_t n = limbs.size();
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 4 <= n; i += 4) {
+    __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i* out = reinterpret_cast<__m128i*>(dst + i);
+    _mm_storeu_si128(out, _mm_add_epi64(_mm_loadu_si128(out), _mm_unpacklo_epi32(cur, zero)));
+    _mm_storeu_si128(out + 1, _mm_add_epi64(_mm_loadu_si128(out + 1), _mm_unpackhi_epi32(cur, zero)));
+  }
+#endif
+  for (; i < n; i++) {
+    dst[i] += src[i];
+  }
+  on_absorb();
+}
+
+void big_accumulator::absorb_short(unsigned long long value, bool negative) {
+  std::vector<uint64_t>& lanes = negative ? this->negative : positive;
+  if (lanes.size() < 2) {
+    lanes.resize(2);
+  }
+  lanes[0] += value & UINT32_MAX;
+  lanes[1] += value >> 32;
+  on_absorb();
+}
+
+void big_accumulator::on_absorb() {
+  if (++pending == std::numeric_limits<uint32_t>::max()) {
+    normalize(positive);
+    normalize(negative);
+    pending = 0;
+  }
+}
+
+void big_accumulator::normalize(std::vector<uint64_t>& lanes) {
+  uint64_t carry = 0;
+  for (uint64_t& lane : lanes) {
+    // lane < 2^64 - 2^32 and carry < 2^32, so the sum can't wrap
+    uint64_t sum = lane + carry;
+    lane = sum & UINT32_MAX;
+    carry = sum >> 32;
+  }
+  while (carry > 0) {
+    lanes.push_back(carry & UINT32_MAX);
+    carry >>= 32;
+  }
+}
+
+big_integer big_accumulator::fold(const std::vector<uint64_t>& lanes) {
+  std::vector<uint32_t> limbs;
+  limbs.reserve(lanes.size() + 2);
+  uint64_t carry = 0;
+  for (uint64_t lane : lanes) {
+    uint64_t low = (lane & UINT32_MAX) + carry;
+    limbs.push_back(static_cast<uint32_t>(low & UINT32_MAX));
+    carry = (lane >> 32) + (low >> 32);
+  }
+  while (carry > 0) {
+    limbs.push_back(static_cast<uint32_t>(carry & UINT32_MAX));
+    carry >>= 32;
+  }
+  while (limbs.size() > 1 && limbs.back() == 0) {
+    limbs.pop_back();
+  }
+  if (limbs.empty()) {
+    limbs.push_back(0);
+  }
+  return big_integer(std::move(limbs), false);
+}
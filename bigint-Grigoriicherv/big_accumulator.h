@@ -0,0 +1,62 @@
+#pragma once
+
+#include "big_integer.h"
+
+#include <concepts>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Sum of many big_integers with deferred carries.
+// Every limb of an addend goes into its own 64-bit lane, so absorbing a value
+// never propagates a carry; carries are resolved only when the sum is read.
+// Positive and negative addends are kept in separate lanes and subtracted once.
+struct big_accumulator {
+  big_accumulator();
+
+  big_accumulator& operator+=(const big_integer& rhs);
+  big_accumulator& operator-=(const big_integer& rhs);
+
+  template <std::integral T>
+  big_accumulator& operator+=(T rhs) {
+    absorb_short(magnitude(rhs), is_negative(rhs));
+    return *this;
+  }
+
+  template <std::integral T>
+  big_accumulator& operator-=(T rhs) {
+    absorb_short(magnitude(rhs), !is_negative(rhs));
+    return *this;
+  }
+
+  big_integer value() const;
+  void clear() noexcept;
+
+private:
+  void absorb(std::vector<uint64_t>& lanes, const std::vector<uint32_t>& limbs);
+  void absorb_short(unsigned long long value, bool negative);
+  void on_absorb();
+
+  template <std::integral T>
+  static bool is_negative(T value) {
+    if constexpr (std::is_signed_v<T>) {
+      return value < 0;
+    } else {
+      return false;
+    }
+  }
+
+  template <std::integral T>
+  static unsigned long long magnitude(T value) {
+    auto bits = static_cast<unsigned long long>(value);
+    return is_negative(value) ? 0 - bits : bits;
+  }
+
+  static void normalize(std::vector<uint64_t>& lanes);
+  static big_integer fold(const std::vector<uint64_t>& lanes);
+
+  std::vector<uint64_t> positive;
+  std::vector<uint64_t> negative;
+  // additions since the last normalisation, a lane overflows after 2^32 of them
+  uint32_t pending{};
+};
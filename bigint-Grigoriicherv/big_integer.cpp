@@ -1,13 +1,61 @@
 #include "big_integer.h"
+#include "big_integer_stats.h"
 
+#include <array>
+#include <bit>
 #include <charconv>
 #include <complex>
 #include <cstddef>
 #include <cstring>
+#include <istream>
 #include <limits>
 #include <ostream>
 #include <stdexcept>
 
+#ifdef BIG_INTEGER_ASM
+#include "big_integer_kernels.h"
+
+#include <cpuid.h>
+
+namespace {
+
+using addmul_fn = uint64_t (*)(uint64_t*, const uint64_t*, size_t, uint64_t);
+
+addmul_fn select_addmul() {
+  unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_BMI2) && (ebx & bit_ADX)) {
+    return bigint_addmul_1_adx;
+  }
+  return bigint_addmul_1;
+}
+
+// The kernel is picked on the first call, not during static
+// initialization, so that big_integers multiplied while other translation
+// units are initialized find it.
+uint64_t addmul(uint64_t* dst, const uint64_t* a, size_t n, uint64_t b) {
+  static const addmul_fn kernel = select_addmul();
+  return kernel(dst, a, n, b);
+}
+
+uint64_t* as_words(uint32_t* limbs) {
+  return reinterpret_cast<uint64_t*>(limbs);
+}
+
+const uint64_t* as_words(const uint32_t* limbs) {
+  return reinterpret_cast<const uint64_t*>(limbs);
+}
+
+std::vector<uint64_t> to_words(const std::vector<uint32_t>& limbs) {
+  std::vector<uint64_t> words((limbs.size() + 1) / 2);
+  if (!limbs.empty()) {
+    std::memcpy(words.data(), limbs.data(), limbs.size() * sizeof(uint32_t));
+  }
+  return words;
+}
+
+} // namespace
+#endif
+
 // Constructors
 
 big_integer::big_integer() = default;
@@ -42,6 +90,7 @@ big_integer::big_integer(unsigned long long a) {
 }
 
 big_integer::big_integer(const std::string& str) {
+  BIG_INTEGER_STATS_SCOPE(from_string, (str.size() + 8) / 9, 0);
   if (str.size() == 0 || (str.size() == 1 && str[0] == '-')) {
     throw std::invalid_argument("Can't parse empty string or '-'");
   }
@@ -99,6 +148,33 @@ void big_integer::mul_short(uint32_t right) {
   shrink();
 }
 
+void big_integer::mul_add_short(uint32_t mul, uint32_t add) {
+  uint64_t carry = add;
+  for (uint32_t& cur : data) {
+    uint64_t temp = static_cast<uint64_t>(cur) * mul + carry;
+    cur = static_cast<uint32_t>(temp & UINT32_MAX);
+    carry = temp >> 32;
+  }
+  if (carry > 0) {
+    data.push_back(static_cast<uint32_t>(carry));
+  }
+}
+
+std::vector<uint32_t> big_integer::decimal_blocks() const {
+  std::vector<uint32_t> blocks;
+  if (data.empty()) {
+    blocks.push_back(0);
+    return blocks;
+  }
+  // 29 full bits per 9 decimal digits is a slight overestimate of the block count
+  blocks.reserve(data.size() * 32 / 29 + 1);
+  big_integer copy(data, false);
+  do {
+    blocks.push_back(copy.div_short(DECIMAL_BLOCK));
+  } while (copy.data.size() > 1 || copy.data[0] != 0);
+  return blocks;
+}
+
 void big_integer::add_short(uint32_t right) {
   if (data.empty() || (data.size() == 1 && data[0] == 0)) {
     data.push_back(right);
@@ -189,6 +265,22 @@ big_integer big_integer::abs() const {
   return sign ? -(*this) : *this;
 }
 
+std::strong_ordering big_integer::cmp_magnitude(const big_integer& b) const {
+  if (data.size() != b.data.size()) {
+    return data.size() <=> b.data.size();
+  }
+  for (size_t i = data.size(); i-- > 0;) {
+    if (data[i] != b.data[i]) {
+      return data[i] <=> b.data[i];
+    }
+  }
+  return std::strong_ordering::equal;
+}
+
+bool big_integer::is_zero() const {
+  return data.empty() || (data.size() == 1 && data[0] == 0);
+}
+
 bool big_integer::cmp_abs(const big_integer& b, bool signing) const {
   if (data.size() != b.data.size()) {
     return (signing ? sign ^ (data.size() < b.data.size()) : (data.size() < b.data.size()));
@@ -209,6 +301,18 @@ bool big_integer::cmp_abs(const big_integer& b, bool signing) const {
 big_integer& big_integer::operator=(const big_integer& other) = default;
 
 void big_integer::adding(const big_integer& rhs) {
+#ifdef BIG_INTEGER_ASM
+  // rhs may be *this, so its size has to be taken before resizing
+  size_t rhs_size = rhs.data.size();
+  data.resize(std::max(data.size(), rhs_size) + 1);
+  size_t words = rhs_size / 2;
+  uint64_t carry = bigint_add_n(as_words(data.data()), as_words(data.data()), as_words(rhs.data.data()), words);
+  for (size_t index = words * 2; index < data.size() && (carry || index < rhs_size); index++) {
+    uint64_t sum = static_cast<uint64_t>(data[index]) + (index < rhs_size ? rhs.data[index] : 0) + carry;
+    data[index] = sum & UINT32_MAX;
+    carry = sum >> 32;
+  }
+#else
   bool carry = false;
   size_t size = std::max(this->data.size() + 1, rhs.data.size() + 1);
   data.resize(size);
@@ -217,12 +321,24 @@ void big_integer::adding(const big_integer& rhs) {
     data[index] = sum & UINT32_MAX;
     carry = sum >> 32;
   }
+#endif
   shrink();
 }
 
 void big_integer::subtracting(const big_integer& rhs, bool rhs_bigger) {
-  bool carry = false;
   std::vector<uint32_t> new_data(std::max(data.size(), rhs.data.size()), 0);
+#ifdef BIG_INTEGER_ASM
+  const std::vector<uint32_t>& larger = rhs_bigger ? rhs.data : data;
+  const std::vector<uint32_t>& smaller = rhs_bigger ? data : rhs.data;
+  size_t words = std::min(smaller.size(), larger.size()) / 2;
+  uint64_t borrow = bigint_sub_n(as_words(new_data.data()), as_words(larger.data()), as_words(smaller.data()), words);
+  for (size_t index = words * 2; index < larger.size(); index++) {
+    uint64_t sub = static_cast<uint64_t>(index < smaller.size() ? smaller[index] : 0) + borrow;
+    borrow = sub > larger[index];
+    new_data[index] = static_cast<uint32_t>(larger[index] - sub);
+  }
+#else
+  bool carry = false;
   for (size_t index = 0; index < (rhs_bigger ? rhs.data.size() : data.size()); index++) {
     uint64_t sub =
         static_cast<uint64_t>(rhs_bigger ? get_if_exist(index, false) : rhs.get_if_exist(index, false)) + carry;
@@ -230,11 +346,13 @@ void big_integer::subtracting(const big_integer& rhs, bool rhs_bigger) {
     new_data[index] =
         static_cast<uint32_t>(~(sub + (rhs_bigger ? ~rhs.get_if_exist(index, false) : ~get_if_exist(index, false))));
   }
+#endif
   data = new_data;
   shrink();
 }
 
 big_integer& big_integer::operator+=(const big_integer& rhs) {
+  BIG_INTEGER_STATS_SCOPE(add, data.size(), rhs.data.size());
   if (sign == rhs.sign) {
     adding(rhs);
     return *this;
@@ -250,6 +368,7 @@ big_integer& big_integer::operator+=(const big_integer& rhs) {
 }
 
 big_integer& big_integer::operator-=(const big_integer& rhs) {
+  BIG_INTEGER_STATS_SCOPE(sub, data.size(), rhs.data.size());
   if (sign == rhs.sign) {
     if (cmp_abs(rhs, false)) {
       subtracting(rhs, true);
@@ -265,6 +384,19 @@ big_integer& big_integer::operator-=(const big_integer& rhs) {
 }
 
 big_integer& big_integer::operator*=(const big_integer& rhs) {
+  BIG_INTEGER_STATS_SCOPE(mul, data.size(), rhs.data.size());
+#ifdef BIG_INTEGER_ASM
+  std::vector<uint64_t> left = to_words(data);
+  std::vector<uint64_t> right = to_words(rhs.data);
+  std::vector<uint64_t> product(left.size() + right.size() + 1);
+  for (size_t i = 0; i < left.size(); i++) {
+    if (left[i] != 0) {
+      product[i + right.size()] = addmul(product.data() + i, right.data(), right.size(), left[i]);
+    }
+  }
+  data.resize(product.size() * 2);
+  std::memcpy(data.data(), product.data(), product.size() * sizeof(uint64_t));
+#else
   std::vector<uint32_t> new_data(data.size() + rhs.data.size() + 1);
   for (size_t i = 0; i < data.size(); i++) {
     if (data[i] == 0) {
@@ -280,6 +412,7 @@ big_integer& big_integer::operator*=(const big_integer& rhs) {
     }
   }
   data = new_data;
+#endif
   sign = sign ^ rhs.sign;
   shrink();
   return *this;
@@ -337,15 +470,18 @@ big_integer& big_integer::div(const big_integer& rhs, bool mod) {
 }
 
 big_integer& big_integer::operator/=(const big_integer& rhs) {
+  BIG_INTEGER_STATS_SCOPE(div, data.size(), rhs.data.size());
   return div(rhs, false);
 }
 
 big_integer& big_integer::operator%=(const big_integer& rhs) {
+  BIG_INTEGER_STATS_SCOPE(mod, data.size(), rhs.data.size());
   return div(rhs, true);
 }
 
 template <class Func>
 big_integer& big_integer::bitwise_operation_assign(const big_integer& rhs, Func operation) {
+  BIG_INTEGER_STATS_SCOPE(bitwise, data.size(), rhs.data.size());
   big_integer left = to_bit_op(*this);
   big_integer right = to_bit_op(rhs);
   data.resize(std::max(data.size(), rhs.data.size()));
@@ -370,6 +506,7 @@ big_integer& big_integer::operator^=(const big_integer& rhs) {
 }
 
 big_integer& big_integer::operator<<=(int rhs) {
+  BIG_INTEGER_STATS_SCOPE(shl, data.size(), 0);
   size_t offset = rhs / 32;
   size_t mod = rhs % 32;
   if (sign) {
@@ -399,6 +536,7 @@ big_integer& big_integer::operator<<=(int rhs) {
 }
 
 big_integer& big_integer::operator>>=(int rhs) {
+  BIG_INTEGER_STATS_SCOPE(shr, data.size(), 0);
   size_t offset = rhs / 32;
 
   std::vector<uint32_t> new_data;
@@ -431,22 +569,26 @@ big_integer big_integer::operator~() const {
 }
 
 big_integer& big_integer::operator++() {
+  BIG_INTEGER_STATS_SCOPE(increment, data.size(), 0);
   sign ? sub_short(1) : add_short(1);
   return *this;
 }
 
 big_integer big_integer::operator++(int) {
+  BIG_INTEGER_STATS_SCOPE(increment, data.size(), 0);
   big_integer res(*this);
   sign ? sub_short(1) : add_short(1);
   return res;
 }
 
 big_integer& big_integer::operator--() {
+  BIG_INTEGER_STATS_SCOPE(decrement, data.size(), 0);
   sign ? add_short(1) : sub_short(1);
   return *this;
 }
 
 big_integer big_integer::operator--(int) {
+  BIG_INTEGER_STATS_SCOPE(decrement, data.size(), 0);
   big_integer res(*this);
   sign ? add_short(1) : sub_short(1);
   return res;
@@ -498,22 +640,13 @@ big_integer operator>>(const big_integer& a, int b) {
 }
 
 bool operator==(const big_integer& a, const big_integer& b) {
-  if (a.data.empty() || b.data.empty()) {
-    return true;
-  }
-  if (a.data.size() != b.data.size()) {
-    if (a.data.empty() && (b.data.size() == 1 && b.data[0] == 0)) {
-      return true;
-    }
-    if (b.data.empty() && (a.data.size() == 1 && a.data[0] == 0)) {
-      return true;
-    }
-    return false;
+  if (a.is_zero() || b.is_zero()) {
+    return a.is_zero() && b.is_zero();
   }
-  if (a.sign != b.sign && (a.data[0] != 0 && b.data[0] != 0)) {
+  if (a.sign != b.sign || a.data.size() != b.data.size()) {
     return false;
   }
-  for (int i = 0; i < a.data.size(); i++) {
+  for (size_t i = a.data.size(); i-- > 0;) {
     if (a.data[i] != b.data[i]) {
       return false;
     }
@@ -525,33 +658,46 @@ bool operator!=(const big_integer& a, const big_integer& b) {
   return !(a == b);
 }
 
-bool operator<(const big_integer& a, const big_integer& b) {
-  if (a.sign != b.sign) {
-    return a.sign;
+std::strong_ordering operator<=>(const big_integer& a, const big_integer& b) {
+  int a_sign = a.is_zero() ? 0 : (a.sign ? -1 : 1);
+  int b_sign = b.is_zero() ? 0 : (b.sign ? -1 : 1);
+  if (a_sign != b_sign || a_sign == 0) {
+    return a_sign <=> b_sign;
   }
-  return a.cmp_abs(b, true);
+  std::strong_ordering magnitude = a.cmp_magnitude(b);
+  return a_sign > 0 ? magnitude : 0 <=> magnitude;
 }
 
-bool operator>(const big_integer& a, const big_integer& b) {
-  return b < a;
-}
-
-bool operator<=(const big_integer& a, const big_integer& b) {
-  return !(a > b);
-}
-
-bool operator>=(const big_integer& a, const big_integer& b) {
-  return !(a < b);
+size_t std::hash<big_integer>::operator()(const big_integer& a) const noexcept {
+  // zero may be stored as an empty vector or with a sign, all of them are equal
+  if (a.is_zero()) {
+    return 0;
+  }
+  const uint64_t factor = 0x9e3779b97f4a7c15;
+  uint64_t hash = a.data.size() * factor + a.sign;
+  size_t i = 0;
+  for (; i + 2 <= a.data.size(); i += 2) {
+    uint64_t word;
+    std::memcpy(&word, a.data.data() + i, sizeof(word));
+    hash = std::rotl((hash ^ word) * factor, 29);
+  }
+  if (i < a.data.size()) {
+    hash = std::rotl((hash ^ a.data[i]) * factor, 29);
+  }
+  hash ^= hash >> 32;
+  hash *= factor;
+  return static_cast<size_t>(hash ^ (hash >> 29));
 }
 
 std::string to_string(const big_integer& a) {
+  BIG_INTEGER_STATS_SCOPE(to_string, a.data.size(), 0);
   if (a == 0) {
     return "0";
   }
   std::string str;
   big_integer copy = a.abs();
   while (copy != 0) {
-    uint32_t digit = copy.div_short(1000000000);
+    uint32_t digit = copy.div_short(big_integer::DECIMAL_BLOCK);
     std::string tmp = std::to_string(digit);
     std::reverse(tmp.begin(), tmp.end());
     str += tmp;
@@ -572,5 +718,90 @@ std::string to_string(const big_integer& a) {
 }
 
 std::ostream& operator<<(std::ostream& out, const big_integer& a) {
-  return out << to_string(a);
+  if (out.width() != 0) {
+    // padding needs the whole length up front
+    return out << to_string(a);
+  }
+  BIG_INTEGER_STATS_SCOPE(to_string, a.data.size(), 0);
+  std::ostream::sentry sentry(out);
+  if (!sentry) {
+    return out;
+  }
+  std::vector<uint32_t> blocks = a.decimal_blocks();
+  std::streambuf* buf = out.rdbuf();
+  std::array<char, 4096> chunk;
+  size_t pos = 0;
+  bool good = true;
+  auto flush = [&] {
+    good = good && buf->sputn(chunk.data(), pos) == static_cast<std::streamsize>(pos);
+    pos = 0;
+  };
+  if (a.sign && (blocks.size() > 1 || blocks[0] != 0)) {
+    chunk[pos++] = '-';
+  }
+  for (size_t i = blocks.size(); i-- > 0;) {
+    if (chunk.size() - pos < big_integer::DECIMAL_BLOCK_DIGITS) {
+      flush();
+    }
+    char digits[big_integer::DECIMAL_BLOCK_DIGITS];
+    size_t len = std::to_chars(digits, digits + sizeof(digits), blocks[i]).ptr - digits;
+    if (i + 1 != blocks.size()) {
+      std::fill_n(chunk.data() + pos, big_integer::DECIMAL_BLOCK_DIGITS - len, '0');
+      pos += big_integer::DECIMAL_BLOCK_DIGITS - len;
+    }
+    std::copy_n(digits, len, chunk.data() + pos);
+    pos += len;
+  }
+  flush();
+  if (!good) {
+    out.setstate(std::ios_base::badbit);
+  }
+  return out;
+}
+
+std::istream& operator>>(std::istream& in, big_integer& a) {
+  // the size is only known once the digits are read
+  BIG_INTEGER_STATS_SCOPE(from_string, 0, 0);
+  std::istream::sentry sentry(in);
+  if (!sentry) {
+    return in;
+  }
+  std::streambuf* buf = in.rdbuf();
+  constexpr int eof = std::char_traits<char>::eof();
+  int ch = buf->sgetc();
+  bool negative = false;
+  if (ch == '-' || ch == '+') {
+    negative = (ch == '-');
+    ch = buf->snextc();
+  }
+  big_integer res(0);
+  uint32_t block = 0;
+  uint32_t block_scale = 1;
+  size_t digits = 0;
+  while (ch != eof && std::isdigit(ch)) {
+    block = block * 10 + (ch - '0');
+    block_scale *= 10;
+    digits++;
+    if (block_scale == big_integer::DECIMAL_BLOCK) {
+      res.mul_add_short(block_scale, block);
+      block = 0;
+      block_scale = 1;
+    }
+    ch = buf->snextc();
+  }
+  if (block_scale != 1) {
+    res.mul_add_short(block_scale, block);
+  }
+  BIG_INTEGER_STATS_SET_SIZE((digits + big_integer::DECIMAL_BLOCK_DIGITS - 1) / big_integer::DECIMAL_BLOCK_DIGITS);
+  if (ch == eof) {
+    in.setstate(std::ios_base::eofbit);
+  }
+  if (digits == 0) {
+    in.setstate(std::ios_base::failbit);
+    return in;
+  }
+  res.shrink();
+  a.data.swap(res.data);
+  a.sign = negative && (a.data.size() > 1 || a.data[0] != 0);
+  return in;
 }
@@ -1,9 +1,15 @@
 #pragma once
 
+#include <compare>
 #include <functional>
 #include <iosfwd>
 #include <string>
 
+struct big_integer;
+
+template <>
+struct std::hash<big_integer>;
+
 struct big_integer {
   big_integer();
   big_integer(const big_integer& other);
@@ -44,13 +50,18 @@ struct big_integer {
 
   friend bool operator==(const big_integer& a, const big_integer& b);
   friend bool operator!=(const big_integer& a, const big_integer& b);
-  friend bool operator<(const big_integer& a, const big_integer& b);
-  friend bool operator>(const big_integer& a, const big_integer& b);
-  friend bool operator<=(const big_integer& a, const big_integer& b);
-  friend bool operator>=(const big_integer& a, const big_integer& b);
+  friend std::strong_ordering operator<=>(const big_integer& a, const big_integer& b);
   friend std::string to_string(const big_integer& a);
+  friend std::ostream& operator<<(std::ostream& out, const big_integer& a);
+  friend std::istream& operator>>(std::istream& in, big_integer& a);
+  friend struct big_accumulator;
+  friend struct std::hash<big_integer>;
 
 private:
+  static constexpr uint32_t DECIMAL_BLOCK = 1000000000;
+  static constexpr size_t DECIMAL_BLOCK_DIGITS = 9;
+
+
   big_integer abs() const;
   uint32_t get_if_exist(size_t index, bool for_bitwise) const;
   void shrink();
@@ -62,11 +73,16 @@ private:
   void adding(const big_integer& rhs);
   void subtracting(const big_integer& rhs, bool rhs_bigger);
   bool cmp_abs(const big_integer& b, bool signing) const;
+  std::strong_ordering cmp_magnitude(const big_integer& b) const;
+  bool is_zero() const;
   big_integer& div(const big_integer& rhs, bool mod);
   uint32_t div_short(uint32_t right);
   void sub_short(uint32_t right);
   void mul_short(uint32_t right);
   void add_short(uint32_t right);
+  void mul_add_short(uint32_t mul, uint32_t add);
+  // base 10^9 digits of the absolute value, least significant first
+  std::vector<uint32_t> decimal_blocks() const;
 
   std::vector<uint32_t> data;
   bool sign{};
@@ -87,10 +103,13 @@ big_integer operator>>(const big_integer& a, int b);
 
 bool operator==(const big_integer& a, const big_integer& b);
 bool operator!=(const big_integer& a, const big_integer& b);
-bool operator<(const big_integer& a, const big_integer& b);
-bool operator>(const big_integer& a, const big_integer& b);
-bool operator<=(const big_integer& a, const big_integer& b);
-bool operator>=(const big_integer& a, const big_integer& b);
+std::strong_ordering operator<=>(const big_integer& a, const big_integer& b);
 
 std::string to_string(const big_integer& a);
 std::ostream& operator<<(std::ostream& out, const big_integer& a);
+std::istream& operator>>(std::istream& in, big_integer& a);
+
+template <>
+struct std::hash<big_integer> {
+  size_t operator()(const big_integer& a) const noexcept;
+};
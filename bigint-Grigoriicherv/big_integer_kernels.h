@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Long arithmetic loops of asm-Grigoriicherv/kernels.asm, linked in when
+// built with BIG_INTEGER_ASM. Numbers are little-endian arrays of qwords.
+
+extern "C" {
+
+// dst = a + b, returns carry out
+uint64_t bigint_add_n(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n);
+
+// dst = a - b, returns borrow out
+uint64_t bigint_sub_n(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n);
+
+// dst += a * b, returns the high qword of the sum
+uint64_t bigint_addmul_1(uint64_t* dst, const uint64_t* a, size_t n, uint64_t b);
+
+// same as bigint_addmul_1, requires BMI2 and ADX
+uint64_t bigint_addmul_1_adx(uint64_t* dst, const uint64_t* a, size_t n, uint64_t b);
+}
@@ -0,0 +1,95 @@
+#include "big_integer_stats.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <new>
+
+namespace big_integer_stats {
+
+namespace {
+
+thread_local snapshot_t counters;
+
+#ifdef BIG_INTEGER_STATS
+// open scopes of this thread, only the outermost one records
+thread_local size_t depth = 0;
+// allocations made by this thread while some scope was open
+thread_local uint64_t allocations = 0;
+#endif
+
+} // namespace
+
+snapshot_t snapshot() noexcept {
+  return counters;
+}
+
+void reset() noexcept {
+  counters = snapshot_t();
+}
+
+#ifdef BIG_INTEGER_STATS
+
+scope::scope(operation op, size_t lhs_size, size_t rhs_size) noexcept
+    : op(op),
+      outermost(depth++ == 0),
+      size(std::max(lhs_size, rhs_size)) {
+  if (!outermost) {
+    return;
+  }
+  old_allocations = allocations;
+  start = std::chrono::steady_clock::now();
+}
+
+scope::~scope() {
+  depth--;
+  if (!outermost) {
+    return;
+  }
+  operation_stats& cur = counters.operations[static_cast<size_t>(op)];
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+  cur.nanoseconds += elapsed.count();
+  cur.calls++;
+  cur.allocations += allocations - old_allocations;
+  size_t bucket = std::bit_width(size);
+  cur.size_histogram[std::min(bucket, SIZE_BUCKETS - 1)]++;
+}
+
+void scope::set_size(size_t lhs_size) noexcept {
+  size = lhs_size;
+}
+
+#endif
+
+} // namespace big_integer_stats
+
+#ifdef BIG_INTEGER_STATS
+
+// Temporaries, copies and grown buffers all come from here, so counting in the
+// global allocation functions catches the ones a single operand can't show.
+// The array and nothrow forms forward to these.
+void* operator new(std::size_t size) {
+  if (big_integer_stats::depth > 0) {
+    big_integer_stats::allocations++;
+  }
+  while (true) {
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+      return ptr;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+#endif
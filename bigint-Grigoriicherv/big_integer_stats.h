@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Opt-in instrumentation of big_integer hot paths.
+// Counters are collected only when BIG_INTEGER_STATS is defined, otherwise
+// every hook expands to nothing and snapshot() always returns zeros.
+
+namespace big_integer_stats {
+
+enum class operation : size_t {
+  add,
+  sub,
+  mul,
+  div,
+  mod,
+  bitwise,
+  shl,
+  shr,
+  increment,
+  decrement,
+  from_string,
+  to_string,
+};
+
+inline constexpr size_t OPERATIONS = static_cast<size_t>(operation::to_string) + 1;
+
+// Bucket i counts operands whose length in limbs (9-digit blocks for from_string)
+// has bit width i, so bucket 0 is an empty operand and the last one collects
+// everything larger.
+inline constexpr size_t SIZE_BUCKETS = 32;
+
+struct operation_stats {
+  uint64_t calls{};
+  uint64_t nanoseconds{};
+  uint64_t allocations{};
+  std::array<uint64_t, SIZE_BUCKETS> size_histogram{};
+};
+
+struct snapshot_t {
+  std::array<operation_stats, OPERATIONS> operations{};
+
+  const operation_stats& operator[](operation op) const {
+    return operations[static_cast<size_t>(op)];
+  }
+};
+
+// Counters of the calling thread.
+snapshot_t snapshot() noexcept;
+void reset() noexcept;
+
+#ifdef BIG_INTEGER_STATS
+
+// Records one call of `op` on scope exit: inclusive time, operand size and
+// heap allocations made meanwhile by this thread (stats builds replace the
+// global operator new to count them). Scopes opened inside another one,
+// e.g. the multiplications done by a division, record nothing, their cost
+// is already part of the outer call.
+class scope {
+public:
+  scope(operation op, size_t lhs_size, size_t rhs_size) noexcept;
+
+  scope(const scope&) = delete;
+  scope& operator=(const scope&) = delete;
+
+  ~scope();
+
+  // replaces the operand size when it is known only at the end, as in operator>>
+  void set_size(size_t lhs_size) noexcept;
+
+private:
+  operation op;
+  bool outermost;
+  size_t size;
+  uint64_t old_allocations{};
+  std::chrono::steady_clock::time_point start;
+};
+
+#define BIG_INTEGER_STATS_SCOPE(op, lhs_size, rhs_size)                                                                \
+  ::big_integer_stats::scope big_integer_stats_scope_(::big_integer_stats::operation::op, lhs_size, rhs_size)
+#define BIG_INTEGER_STATS_SET_SIZE(lhs_size) big_integer_stats_scope_.set_size(lhs_size)
+
+#else
+
+#define BIG_INTEGER_STATS_SCOPE(op, lhs_size, rhs_size)
+#define BIG_INTEGER_STATS_SET_SIZE(lhs_size)
+
+#endif
+
+} // namespace big_integer_stats
@@ -1,12 +1,17 @@
+#include "big_accumulator.h"
 #include "big_integer.h"
+#include "big_integer_stats.h"
 #include "gtest/gtest.h"
 
 #include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cstdlib>
+#include <iomanip>
 #include <limits>
+#include <sstream>
 #include <string>
+#include <unordered_set>
 
 namespace {
 
@@ -29,6 +34,10 @@ private:
   std::chrono::steady_clock::time_point clock_start;
 };
 
+// computed during static initialization, possibly before that of
+// big_integer.cpp
+const big_integer static_product = big_integer("123456789012345678901234567890") * big_integer(-987654321);
+
 } // namespace
 
 int main(int argc, char** argv) {
@@ -45,6 +54,10 @@ TEST(correctness, two_plus_two) {
   EXPECT_EQ(4, 2 + big_integer(2));
 }
 
+TEST(correctness, multiply_during_static_init) {
+  EXPECT_EQ(big_integer("-121932631124828532112482853211126352690"), static_product);
+}
+
 TEST(correctness, default_ctor) {
   big_integer a;
   big_integer b = 0;
@@ -647,6 +660,27 @@ TEST(correctness, mul_long_pow2) {
   EXPECT_EQ(c, b * b);
 }
 
+TEST(correctness, mixed_lengths) {
+  big_integer a("-1");
+  big_integer b("1");
+  for (int i = 0; i < 40; i++) {
+    big_integer sum = a + b;
+    big_integer diff = a - b;
+    EXPECT_EQ(a, sum - b);
+    EXPECT_EQ(b, sum - a);
+    EXPECT_EQ(a, diff + b);
+    EXPECT_EQ(a * b, b * a);
+    EXPECT_EQ(a + a, a * 2);
+    big_integer self = a;
+    self *= self;
+    EXPECT_EQ(a * big_integer(a), self);
+    a = a * 4294967295u - 12345;
+    if (i % 3 == 0) {
+      b = b * 12345678901234567ull + 1;
+    }
+  }
+}
+
 TEST(correctness, div_0_long) {
   big_integer a;
   big_integer b("100000000000000000000000000000000000000000000000000000000000");
@@ -728,6 +762,78 @@ TEST(correctness, string_conv) {
   EXPECT_EQ("-2147483649", to_string(lim));
 }
 
+TEST(correctness, stream_output) {
+  std::string str = "-123456789000000000000000000000000000000000000000000000000000000000001";
+  std::ostringstream out;
+  out << big_integer(str) << ' ' << big_integer(0) << ' ' << big_integer("-0") << ' ' << big_integer(1000000000);
+  EXPECT_EQ(str + " 0 0 1000000000", out.str());
+
+  std::ostringstream padded;
+  padded << std::setw(5) << big_integer(42);
+  EXPECT_EQ("   42", padded.str());
+}
+
+TEST(correctness, stream_input) {
+  std::istringstream in("  -123456789000000000000000000001 +42\n0000000000000000000017 -0 x");
+  big_integer a, b, c, d;
+  in >> a >> b >> c >> d;
+  EXPECT_TRUE(in);
+  EXPECT_EQ(big_integer("-123456789000000000000000000001"), a);
+  EXPECT_EQ(42, b);
+  EXPECT_EQ(17, c);
+  EXPECT_EQ(0, d);
+  EXPECT_EQ("0", to_string(d));
+
+  big_integer e = 5;
+  in >> e;
+  EXPECT_TRUE(in.fail());
+  EXPECT_EQ(5, e);
+}
+
+TEST(correctness, stream_round_trip) {
+  std::string str(20000, '7');
+  std::istringstream in(str);
+  big_integer a;
+  in >> a;
+  EXPECT_TRUE(in.eof());
+  std::ostringstream out;
+  out << a;
+  EXPECT_EQ(str, out.str());
+}
+
+TEST(correctness, three_way_compare) {
+  big_integer a("-100000000000000000000000000");
+  big_integer b("-99999999999999999999999999");
+  big_integer c("99999999999999999999999999");
+  EXPECT_EQ(std::strong_ordering::less, a <=> b);
+  EXPECT_EQ(std::strong_ordering::less, b <=> 0);
+  EXPECT_EQ(std::strong_ordering::greater, c <=> b);
+  EXPECT_EQ(std::strong_ordering::equal, c <=> big_integer(c));
+  EXPECT_EQ(std::strong_ordering::equal, big_integer("-0") <=> big_integer());
+  EXPECT_EQ(std::strong_ordering::less, big_integer() <=> 1);
+  EXPECT_TRUE(big_integer("-0") == 0);
+  EXPECT_FALSE(big_integer() == 1);
+  EXPECT_FALSE(c == -c);
+}
+
+TEST(correctness, hash) {
+  std::hash<big_integer> hash;
+  EXPECT_EQ(hash(big_integer()), hash(big_integer("-0")));
+  EXPECT_EQ(hash(big_integer("123456789123456789123456789")), hash(big_integer("123456789123456789123456789")));
+  EXPECT_NE(hash(big_integer(5)), hash(big_integer(-5)));
+
+  std::unordered_set<big_integer> keys;
+  big_integer cur = 1;
+  for (int i = 0; i < 1000; i++) {
+    keys.insert(cur);
+    keys.insert(-cur);
+    cur = cur * 3 + 1;
+  }
+  EXPECT_EQ(2000, keys.size());
+  EXPECT_EQ(1, keys.count(big_integer(-4)));
+  EXPECT_EQ(0, keys.count(big_integer(2)));
+}
+
 namespace {
 template <typename T>
 void test_converting_ctor(T value) {
@@ -792,3 +898,149 @@ TEST(correctness, converting_ctor4) {
 
   EXPECT_EQ(to_string(bignum), std::to_string(num));
 }
+
+#ifdef ENABLE_TIME_LIMITS
+// Runs the add and multiply kernels on long operands, compare the time gtest
+// reports for it between builds with and without BIG_INTEGER_ASM.
+TEST(performance, long_mul_add) {
+  constexpr int ITERATIONS = 200;
+  big_integer a = (big_integer(1) << 32 * 512) - 1;
+  big_integer b = (big_integer(1) << 32 * 256) - 3;
+  big_integer sum;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; i++) {
+    sum += a * b;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_LE(elapsed, std::chrono::milliseconds(250));
+  EXPECT_EQ(a * b * ITERATIONS, sum);
+}
+#endif
+
+TEST(accumulator, empty) {
+  big_accumulator acc;
+  EXPECT_EQ(0, acc.value());
+  EXPECT_EQ("0", to_string(acc.value()));
+}
+
+TEST(accumulator, machine_integers) {
+  big_accumulator acc;
+  acc += std::numeric_limits<long long>::min();
+  acc += std::numeric_limits<unsigned long long>::max();
+  acc -= -5;
+  acc -= 7u;
+  big_integer expected = big_integer(std::numeric_limits<long long>::min()) +
+                         big_integer(std::numeric_limits<unsigned long long>::max()) + 5 - 7;
+  EXPECT_EQ(expected, acc.value());
+}
+
+TEST(accumulator, matches_sum) {
+  big_accumulator acc;
+  big_integer expected = 0;
+  big_integer cur("-9999999999999999999999999999999999999999999999999999999999");
+  for (int i = 0; i < 1000; i++) {
+    cur = cur * 3 + i;
+    if (i % 3 == 0) {
+      acc -= cur;
+      expected -= cur;
+    } else {
+      acc += cur;
+      expected += cur;
+    }
+    acc += i;
+    expected += i;
+  }
+  EXPECT_EQ(expected, acc.value());
+  acc.clear();
+  EXPECT_EQ(0, acc.value());
+}
+
+TEST(stats, reset) {
+  big_integer a = 2;
+  a *= a;
+  big_integer_stats::reset();
+  for (const auto& op : big_integer_stats::snapshot().operations) {
+    EXPECT_EQ(0, op.calls);
+  }
+}
+
+#ifdef BIG_INTEGER_STATS
+TEST(stats, counts_operations) {
+  big_integer a("123456789012345678901234567890");
+  big_integer_stats::reset();
+  a += a;
+  a += 1;
+  a *= a;
+  auto stats = big_integer_stats::snapshot();
+  EXPECT_EQ(2, stats[big_integer_stats::operation::add].calls);
+  EXPECT_EQ(1, stats[big_integer_stats::operation::mul].calls);
+  EXPECT_EQ(0, stats[big_integer_stats::operation::div].calls);
+  EXPECT_EQ(1, stats[big_integer_stats::operation::mul].size_histogram[3]);
+  EXPECT_LT(0, stats[big_integer_stats::operation::mul].allocations);
+}
+
+TEST(stats, records_only_outermost_operation) {
+  big_integer_stats::reset();
+  big_integer a("1234567890123456789");
+  auto stats = big_integer_stats::snapshot();
+  EXPECT_EQ(1, stats[big_integer_stats::operation::from_string].calls);
+  EXPECT_EQ(0, stats[big_integer_stats::operation::mul].calls);
+  EXPECT_EQ(0, stats[big_integer_stats::operation::add].calls);
+
+  big_integer b("123456789012345678901234567890123456789");
+  big_integer_stats::reset();
+  b /= a;
+  stats = big_integer_stats::snapshot();
+  EXPECT_EQ(1, stats[big_integer_stats::operation::div].calls);
+  for (auto op : {big_integer_stats::operation::add, big_integer_stats::operation::sub,
+                  big_integer_stats::operation::mul, big_integer_stats::operation::shl}) {
+    EXPECT_EQ(0, stats[op].calls);
+    EXPECT_EQ(0, stats[op].nanoseconds);
+  }
+  EXPECT_EQ(big_integer("100000000000000000001"), b);
+}
+
+TEST(stats, counts_allocations_of_temporaries) {
+  big_integer a("123456789012345678901234567890");
+  big_integer b("1234567890123456789");
+  big_integer_stats::reset();
+  a += 1;
+  a %= b;
+  auto stats = big_integer_stats::snapshot();
+  EXPECT_EQ(0, stats[big_integer_stats::operation::add].allocations);
+  // the quotient and remainder are built in copies of both operands
+  EXPECT_LE(2, stats[big_integer_stats::operation::mod].allocations);
+  EXPECT_EQ(1234567891, a);
+}
+
+TEST(stats, reads_streams_like_strings) {
+  std::string digits(200, '7');
+  big_integer_stats::reset();
+  big_integer parsed(digits);
+  auto from_string = big_integer_stats::snapshot()[big_integer_stats::operation::from_string];
+
+  big_integer read(digits + digits);
+  std::istringstream in(digits);
+  big_integer_stats::reset();
+  in >> read;
+  auto from_stream = big_integer_stats::snapshot()[big_integer_stats::operation::from_string];
+  EXPECT_EQ(parsed, read);
+  EXPECT_EQ(1, from_stream.calls);
+  EXPECT_EQ(from_string.size_histogram, from_stream.size_histogram);
+  EXPECT_EQ(0, big_integer_stats::snapshot()[big_integer_stats::operation::mul].calls);
+}
+
+TEST(stats, counts_increments_and_decrements_apart) {
+  big_integer a = 5;
+  big_integer_stats::reset();
+  ++a;
+  a++;
+  --a;
+  a--;
+  a--;
+  auto stats = big_integer_stats::snapshot();
+  EXPECT_EQ(2, stats[big_integer_stats::operation::increment].calls);
+  EXPECT_EQ(3, stats[big_integer_stats::operation::decrement].calls);
+  EXPECT_EQ(4, a);
+}
+#endif
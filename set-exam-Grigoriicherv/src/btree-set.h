@@ -0,0 +1,1036 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "sorted-unique.h"
+#include "tree-shape.h"
+
+// Sorted set of unique keys kept in a B-tree. A node packs as many keys as
+// fit in NodeBytes bytes, but at least three, so a lookup touches a few
+// cache lines per level instead of one node per key. Inner nodes also hold
+// the child pointers and so take fewer keys than leaves. Arithmetic keys
+// ordered by std::less are searched inside a node with vector comparisons.
+//
+// The interface follows set, but keys live in the nodes and move on
+// rebalancing: insert and erase invalidate all iterators, hints are
+// ignored, and there are no node handles or order statistics. A move
+// half done between nodes cannot be undone, so T must move without
+// throwing; insertion is then strong and erasure at an iterator nothrow.
+template <typename T, size_t NodeBytes = 256, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+class btree_set {
+  static_assert(std::is_nothrow_move_constructible_v<T> && std::is_nothrow_move_assignable_v<T>,
+                "btree_set moves keys between nodes and cannot undo a throwing move");
+
+  struct inner;
+
+  struct node {
+    inner* parent = nullptr;
+    // keys in the node
+    uint16_t count = 0;
+    // index among the children of parent
+    uint16_t position = 0;
+    bool leaf = true;
+  };
+
+  // Nodes have one spare key slot: an insertion into a full node fills it
+  // and then the node is split in halves around the middle key. Keys start
+  // right after the header in both kinds of node, children follow the keys
+  // of an inner node.
+  static constexpr size_t round_up(size_t bytes, size_t align) {
+    return (bytes + align - 1) / align * align;
+  }
+
+  static constexpr size_t node_align = std::max(alignof(node), alignof(T));
+  static constexpr size_t keys_end(size_t slots) {
+    return round_up(sizeof(node), alignof(T)) + (slots + 1) * sizeof(T);
+  }
+  static constexpr size_t leaf_bytes(size_t slots) {
+    return round_up(keys_end(slots), node_align);
+  }
+  static constexpr size_t inner_bytes(size_t slots) {
+    return round_up(round_up(keys_end(slots), alignof(node*)) + (slots + 2) * sizeof(node*), node_align);
+  }
+
+  // the most keys, but at least 3, for which a node takes at most NodeBytes
+  static constexpr size_t fitting(size_t (*bytes)(size_t)) {
+    size_t slots = 3;
+    while (slots < UINT16_MAX - 1 && bytes(slots + 1) <= NodeBytes) {
+      slots++;
+    }
+    return slots;
+  }
+
+  static constexpr size_t leaf_slots = fitting(leaf_bytes);
+  static constexpr size_t inner_slots = fitting(inner_bytes);
+
+  template <size_t Slots>
+  struct keyed : node {
+    union {
+      T keys[Slots + 1];
+    };
+
+    keyed() noexcept {}
+    ~keyed() {}
+  };
+
+  struct leaf_node : keyed<leaf_slots> {
+    leaf_node() noexcept {}
+  };
+
+  struct inner : keyed<inner_slots> {
+    node* children[inner_slots + 2] = {};
+
+    inner() noexcept {
+      this->leaf = false;
+    }
+  };
+
+  static_assert(sizeof(leaf_node) == leaf_bytes(leaf_slots) && sizeof(inner) == inner_bytes(inner_slots));
+
+  using leaf_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<leaf_node>;
+  using leaf_traits = std::allocator_traits<leaf_allocator>;
+  using inner_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<inner>;
+  using inner_traits = std::allocator_traits<inner_allocator>;
+
+  static T* keys(node* nd) noexcept {
+    return nd->leaf ? static_cast<leaf_node*>(nd)->keys : static_cast<inner*>(nd)->keys;
+  }
+
+  static const T* keys(const node* nd) noexcept {
+    return nd->leaf ? static_cast<const leaf_node*>(nd)->keys : static_cast<const inner*>(nd)->keys;
+  }
+
+  static size_t capacity(const node* nd) noexcept {
+    return nd->leaf ? leaf_slots : inner_slots;
+  }
+
+  // every node but the root holds at least that many keys
+  static size_t min_keys(const node* nd) noexcept {
+    return capacity(nd) / 2;
+  }
+
+  // vector search needs plain values and the natural order
+  static constexpr bool simd_search = std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && sizeof(T) >= 4 &&
+                                      (std::is_same_v<Compare, std::less<T>> || std::is_same_v<Compare, std::less<>>);
+
+  static constexpr bool transparent = requires { typename Compare::is_transparent; };
+
+  template <typename R>
+  struct my_iterator {
+    friend class btree_set;
+
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const R*;
+    using reference = const R&;
+
+    my_iterator() = default;
+
+    my_iterator& operator++() {
+      if (!nd->leaf) {
+        nd = static_cast<inner*>(nd)->children[index + 1];
+        while (!nd->leaf) {
+          nd = static_cast<inner*>(nd)->children[0];
+        }
+        index = 0;
+        return *this;
+      }
+      if (++index < nd->count) {
+        return *this;
+      }
+      // climb to the first ancestor where we came from the left,
+      // past the last key stay at end(), that is (last leaf, count)
+      node* cur = nd;
+      while (cur->parent != nullptr && cur->position == cur->parent->count) {
+        cur = cur->parent;
+      }
+      if (cur->parent != nullptr) {
+        index = cur->position;
+        nd = cur->parent;
+      }
+      return *this;
+    }
+
+    my_iterator operator++(int) {
+      my_iterator x = *this;
+      ++*this;
+      return x;
+    }
+
+    my_iterator& operator--() {
+      if (!nd->leaf) {
+        nd = static_cast<inner*>(nd)->children[index];
+        while (!nd->leaf) {
+          nd = static_cast<inner*>(nd)->children[nd->count];
+        }
+        index = nd->count - 1;
+        return *this;
+      }
+      if (index > 0) {
+        --index;
+        return *this;
+      }
+      while (nd->position == 0) {
+        nd = nd->parent;
+      }
+      index = nd->position - 1;
+      nd = nd->parent;
+      return *this;
+    }
+
+    my_iterator operator--(int) {
+      my_iterator x = *this;
+      --*this;
+      return x;
+    }
+
+    const R& operator*() const {
+      return keys(nd)[index];
+    }
+
+    const R* operator->() const {
+      return &keys(nd)[index];
+    }
+
+    friend bool operator==(my_iterator const& a, my_iterator const& b) {
+      return a.nd == b.nd && a.index == b.index;
+    }
+
+    friend bool operator!=(my_iterator const& a, my_iterator const& b) {
+      return !(a == b);
+    }
+
+  private:
+    my_iterator(node* nd, size_t index) : nd(nd), index(index) {}
+
+    node* nd = nullptr;
+    size_t index = 0;
+  };
+
+public:
+  using value_type = T;
+
+  using reference = T&;
+  using const_reference = const T&;
+
+  using pointer = T*;
+  using const_pointer = const T*;
+
+  using iterator = my_iterator<T>;
+  using const_iterator = my_iterator<T>;
+
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  using allocator_type = Allocator;
+  using key_compare = Compare;
+  using value_compare = Compare;
+
+  // O(1) nothrow for nothrow constructible allocators
+  btree_set() noexcept(std::is_nothrow_default_constructible_v<Compare> &&
+                       std::is_nothrow_default_constructible_v<Allocator>) = default;
+
+  // O(1)
+  explicit btree_set(const Compare& comp, const Allocator& alloc = Allocator()) : alloc(alloc), comp(comp) {}
+
+  // O(1)
+  explicit btree_set(const Allocator& alloc) : btree_set(Compare(), alloc) {}
+
+  // O(n) strong
+  btree_set(const btree_set& other)
+      : btree_set(other.comp, std::allocator_traits<Allocator>::select_on_container_copy_construction(other.alloc)) {
+    if (other.root != nullptr) {
+      root = clone(other.root, nullptr);
+      size_set = other.size_set;
+      update_ends();
+    }
+  }
+
+  // O(1) nothrow
+  btree_set(btree_set&& other) noexcept : btree_set(other.comp, other.alloc) {
+    swap(*this, other);
+  }
+
+  // O(n) strong, [first, last) must be strictly increasing. Keys are
+  // appended to the right edge of the tree, filling the nodes, so there is
+  // no search and no split.
+  template <std::input_iterator It>
+  btree_set(sorted_unique_t, It first, It last, const Compare& comp = Compare(), const Allocator& alloc = Allocator())
+      : btree_set(comp, alloc) {
+    try {
+      for (; first != last; ++first) {
+        append(*first);
+      }
+    } catch (...) {
+      clear();
+      throw;
+    }
+    finish_append();
+  }
+
+  // O(n) strong
+  btree_set& operator=(const btree_set& other) {
+    btree_set tmp(other);
+    swap(tmp, *this);
+    return *this;
+  }
+
+  // O(n) nothrow
+  btree_set& operator=(btree_set&& other) noexcept {
+    btree_set tmp(std::move(other));
+    swap(tmp, *this);
+    return *this;
+  }
+
+  // O(n) nothrow
+  ~btree_set() noexcept {
+    clear();
+  }
+
+  // O(n) nothrow
+  void clear() noexcept {
+    if (root != nullptr) {
+      free_tree(root);
+    }
+    root = nullptr;
+    leftmost = rightmost = nullptr;
+    size_set = 0;
+  }
+
+  // O(1) nothrow
+  size_t size() const noexcept {
+    return size_set;
+  }
+
+  // O(1) nothrow
+  bool empty() const noexcept {
+    return size_set == 0;
+  }
+
+  allocator_type get_allocator() const {
+    return alloc;
+  }
+
+  key_compare key_comp() const {
+    return comp;
+  }
+
+  value_compare value_comp() const {
+    return comp;
+  }
+
+  // O(1) nothrow
+  const_iterator begin() const noexcept {
+    return const_iterator(leftmost, 0);
+  }
+
+  // O(1) nothrow
+  const_iterator end() const noexcept {
+    return const_iterator(rightmost, rightmost == nullptr ? 0 : rightmost->count);
+  }
+
+  // O(1) nothrow
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+
+  // O(1) nothrow
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+
+  // O(log n) strong
+  std::pair<iterator, bool> insert(const T& el) {
+    return inserting(el);
+  }
+
+  // O(log n) strong, el is left untouched if not inserted
+  std::pair<iterator, bool> insert(T&& el) {
+    return inserting(std::move(el));
+  }
+
+  // O(log n) strong, keys move on insertion, so the hint is not used
+  iterator insert(const_iterator, const T& el) {
+    return inserting(el).first;
+  }
+
+  // O(log n) strong
+  iterator insert(const_iterator, T&& el) {
+    return inserting(std::move(el)).first;
+  }
+
+  // O(n + m) strong, O(m log(n + m)) for short forward ranges,
+  // [first, last) must be sorted. Copies the merge of the keys and
+  // [first, last) into a new tree built as by the sorted_unique constructor.
+  template <std::input_iterator It>
+  void insert_sorted(It first, It last) {
+    if constexpr (std::forward_iterator<It>) {
+      size_t m = static_cast<size_t>(std::distance(first, last));
+      if (m * std::bit_width(size_set) < size_set) {
+        for (; first != last; ++first) {
+          insert(*first);
+        }
+        return;
+      }
+    }
+    btree_set res(comp, alloc);
+    const_iterator old = begin();
+    const T* added = nullptr;
+    for (; first != last; ++first) {
+      for (; old != end() && comp(*old, *first); ++old) {
+        added = &res.append(*old);
+      }
+      if (old != end() && !comp(*first, *old)) {
+        continue;
+      }
+      if (added != nullptr && !comp(*added, *first)) {
+        continue;
+      }
+      added = &res.append(*first);
+    }
+    for (; old != end(); ++old) {
+      res.append(*old);
+    }
+    res.finish_append();
+    swap(res, *this);
+  }
+
+  // O(log n) strong
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    return inserting(T(std::forward<Args>(args)...));
+  }
+
+  // O(log n) strong
+  template <typename... Args>
+  iterator emplace_hint(const_iterator, Args&&... args) {
+    return inserting(T(std::forward<Args>(args)...)).first;
+  }
+
+  // O(log n) nothrow
+  iterator erase(const_iterator pos) {
+    return erasing(pos.nd, pos.index);
+  }
+
+  // O(log n) strong
+  size_t erase(const T& val) {
+    const_iterator it = find(val);
+    if (it == end()) {
+      return 0;
+    }
+    erase(it);
+    return 1;
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent && (!std::is_convertible_v<const K&, const_iterator>)
+  size_t erase(const K& key) {
+    const_iterator it = find(key);
+    if (it == end()) {
+      return 0;
+    }
+    erase(it);
+    return 1;
+  }
+
+  // O(log n) strong
+  const_iterator lower_bound(const T& val) const {
+    return bounding<false>(val);
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator lower_bound(const K& key) const {
+    return bounding<false>(key);
+  }
+
+  // O(log n) strong
+  const_iterator upper_bound(const T& val) const {
+    return bounding<true>(val);
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator upper_bound(const K& key) const {
+    return bounding<true>(key);
+  }
+
+  // O(log n) strong
+  iterator find(const T& val) const {
+    return finding(val);
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  iterator find(const K& key) const {
+    return finding(key);
+  }
+
+  // O(n) nothrow, height and mean depth of the keys in levels, node_bytes
+  // counts whole nodes, unused key slots included
+  tree_shape shape() const noexcept {
+    tree_shape res{size_set, 0, 0, 0};
+    if (root == nullptr) {
+      return res;
+    }
+    size_t total_depth = 0;
+    measure(root, 1, res, total_depth);
+    res.average_depth = static_cast<double>(total_depth) / static_cast<double>(size_set);
+    return res;
+  }
+
+  // O(1) nothrow, allocators are swapped with the nodes
+  friend void swap(btree_set& a, btree_set& b) noexcept {
+    using std::swap;
+    swap(a.alloc, b.alloc);
+    swap(a.comp, b.comp);
+    std::swap(a.root, b.root);
+    std::swap(a.leftmost, b.leftmost);
+    std::swap(a.rightmost, b.rightmost);
+    std::swap(a.size_set, b.size_set);
+  }
+
+private:
+  // index of the first key in nd not less than val (Upper: greater than val)
+  template <bool Upper, typename K>
+  size_t search(const node* nd, const K& val) const {
+    if constexpr (simd_search && std::is_same_v<K, T>) {
+      return count_less<Upper>(keys(nd), nd->count, val);
+    } else if constexpr (Upper) {
+      return std::upper_bound(keys(nd), keys(nd) + nd->count, val, comp) - keys(nd);
+    } else {
+      return std::lower_bound(keys(nd), keys(nd) + nd->count, val, comp) - keys(nd);
+    }
+  }
+
+  // Counts keys less than (Upper: not greater than) val comparing a vector
+  // register of keys at a time. A linear scan without branches beats a
+  // binary search on the few cache lines of a node.
+  template <bool Upper>
+  static size_t count_less(const T* keys, size_t n, T val) noexcept {
+    size_t i = 0;
+    size_t res = 0;
+#if defined(__GNUC__)
+    typedef T vec __attribute__((vector_size(16)));
+    constexpr size_t lanes = sizeof(vec) / sizeof(T);
+    vec pivot = vec{} + val;
+    decltype(pivot < pivot) acc{};
+    for (; i + lanes <= n; i += lanes) {
+      vec cur;
+      std::memcpy(&cur, keys + i, sizeof(cur));
+      // true lanes are -1
+      if constexpr (Upper) {
+        acc += cur <= pivot;
+      } else {
+        acc += cur < pivot;
+      }
+    }
+    for (size_t j = 0; j < lanes; j++) {
+      res -= acc[j];
+    }
+#endif
+    for (; i < n; i++) {
+      res += Upper ? !(val < keys[i]) : keys[i] < val;
+    }
+    return res;
+  }
+
+  template <bool Upper, typename K>
+  const_iterator bounding(const K& val) const {
+    const_iterator res = end();
+    node* nd = root;
+    while (nd != nullptr) {
+      size_t i = search<Upper>(nd, val);
+      if (i < nd->count) {
+        res = const_iterator(nd, i);
+      }
+      if (nd->leaf) {
+        break;
+      }
+      nd = static_cast<inner*>(nd)->children[i];
+    }
+    return res;
+  }
+
+  template <typename K>
+  iterator finding(const K& val) const {
+    node* nd = root;
+    while (nd != nullptr) {
+      size_t i = search<false>(nd, val);
+      if (i < nd->count && !comp(val, keys(nd)[i])) {
+        return iterator(nd, i);
+      }
+      if (nd->leaf) {
+        break;
+      }
+      nd = static_cast<inner*>(nd)->children[i];
+    }
+    return end();
+  }
+
+  // Finds the leaf slot of el, builds the value and allocates every node
+  // the splits will need before touching the tree.
+  template <typename V>
+  std::pair<iterator, bool> inserting(V&& el) {
+    node* nd = root;
+    size_t i = 0;
+    while (nd != nullptr) {
+      i = search<false>(nd, el);
+      if (i < nd->count && !comp(el, keys(nd)[i])) {
+        return {iterator(nd, i), false};
+      }
+      if (nd->leaf) {
+        break;
+      }
+      nd = static_cast<inner*>(nd)->children[i];
+    }
+
+    T value(std::forward<V>(el));
+    node* spare[64] = {};
+    size_t splits = 0;
+    try {
+      if (nd == nullptr) {
+        spare[splits++] = new_leaf();
+      } else {
+        node* cur = nd;
+        while (cur != nullptr && cur->count == capacity(cur)) {
+          spare[splits] = cur->leaf ? new_leaf() : new_inner();
+          splits++;
+          cur = cur->parent;
+        }
+        if (cur == nullptr) {
+          spare[splits++] = new_inner();
+        }
+      }
+    } catch (...) {
+      for (size_t j = 0; j < splits; j++) {
+        delete_node(spare[j]);
+      }
+      throw;
+    }
+
+    if (nd == nullptr) {
+      root = nd = spare[0];
+      construct_key(nd, 0, std::move(value));
+      nd->count = 1;
+      size_set = 1;
+      update_ends();
+      return {iterator(nd, 0), true};
+    }
+
+    construct_key(nd, nd->count, std::move(value));
+    std::rotate(keys(nd) + i, keys(nd) + nd->count, keys(nd) + nd->count + 1);
+    nd->count++;
+    size_set++;
+
+    // locate the new key after the splits by the leaf it ends up in
+    node* at = nd;
+    size_t at_index = i;
+    node** next_spare = spare;
+    while (nd->count > capacity(nd)) {
+      node* sibling = *next_spare++;
+      size_t mid = (capacity(nd) + 1) / 2;
+      if (at == nd && at_index > mid) {
+        at = sibling;
+        at_index -= mid + 1;
+      }
+      T median = split(nd, sibling, mid);
+      if (at == nd && at_index == mid) {
+        // the new key itself goes up, after the split it is the median
+        at = nullptr;
+      }
+      if (nd->parent == nullptr) {
+        inner* top = static_cast<inner*>(*next_spare++);
+        construct_key(top, 0, std::move(median));
+        top->count = 1;
+        attach(top, 0, nd);
+        attach(top, 1, sibling);
+        root = top;
+        if (at == nullptr) {
+          at = top;
+          at_index = 0;
+        }
+        break;
+      }
+      inner* par = nd->parent;
+      size_t p = nd->position;
+      construct_key(par, par->count, std::move(median));
+      std::rotate(keys(par) + p, keys(par) + par->count, keys(par) + par->count + 1);
+      for (size_t j = par->count + 1; j > p + 1; j--) {
+        attach(par, j, par->children[j - 1]);
+      }
+      attach(par, p + 1, sibling);
+      par->count++;
+      if (at == nullptr) {
+        at = par;
+        at_index = p;
+      }
+      nd = par;
+    }
+    update_ends();
+    return {iterator(at, at_index), true};
+  }
+
+  // moves keys after mid to the empty sibling, children too for inner nodes,
+  // and returns the key at mid
+  T split(node* nd, node* sibling, size_t mid) noexcept {
+    size_t moved = nd->count - mid - 1;
+    for (size_t j = 0; j < moved; j++) {
+      construct_key(sibling, j, std::move(keys(nd)[mid + 1 + j]));
+    }
+    sibling->count = static_cast<uint16_t>(moved);
+    if (!nd->leaf) {
+      inner* from = static_cast<inner*>(nd);
+      inner* to = static_cast<inner*>(sibling);
+      for (size_t j = 0; j <= moved; j++) {
+        attach(to, j, from->children[mid + 1 + j]);
+        from->children[mid + 1 + j] = nullptr;
+      }
+    }
+    T median(std::move(keys(nd)[mid]));
+    destroy_keys(nd, mid, nd->count);
+    nd->count = static_cast<uint16_t>(mid);
+    return median;
+  }
+
+  // Erases the key at (nd, i) and returns the position of its successor.
+  // A key of an inner node is replaced by its successor from a leaf, so
+  // only leaves lose keys; underfull nodes then borrow a key from a sibling
+  // or are merged with it, going up while the parent becomes underfull.
+  iterator erasing(node* nd, size_t i) noexcept {
+    bool from_inner = !nd->leaf;
+    if (from_inner) {
+      node* leaf = static_cast<inner*>(nd)->children[i + 1];
+      while (!leaf->leaf) {
+        leaf = static_cast<inner*>(leaf)->children[0];
+      }
+      keys(nd)[i] = std::move(keys(leaf)[0]);
+      nd = leaf;
+      i = 0;
+    }
+    std::move(keys(nd) + i + 1, keys(nd) + nd->count, keys(nd) + i);
+    destroy_keys(nd, nd->count - 1, nd->count);
+    nd->count--;
+    size_set--;
+
+    // (at, at_index) follows the key after the erased one in the leaf
+    node* at = nd;
+    size_t at_index = i;
+    while (nd != root && nd->count < min_keys(nd)) {
+      inner* par = nd->parent;
+      size_t p = nd->position;
+      node* left = p > 0 ? par->children[p - 1] : nullptr;
+      node* right = p < par->count ? par->children[p + 1] : nullptr;
+      if (left != nullptr && left->count > min_keys(left)) {
+        borrow_left(par, p);
+        if (at == nd) {
+          at_index++;
+        }
+        break;
+      }
+      if (right != nullptr && right->count > min_keys(right)) {
+        borrow_right(par, p);
+        break;
+      }
+      if (left != nullptr) {
+        if (at == nd) {
+          at = left;
+          at_index += left->count + 1;
+        }
+        merge(par, p - 1);
+      } else {
+        merge(par, p);
+      }
+      nd = par;
+    }
+
+    if (root->count == 0) {
+      node* old = root;
+      root = old->leaf ? nullptr : static_cast<inner*>(old)->children[0];
+      if (root != nullptr) {
+        root->parent = nullptr;
+        root->position = 0;
+      } else {
+        at = nullptr;
+      }
+      delete_node(old);
+    }
+    update_ends();
+    if (at == nullptr) {
+      return end();
+    }
+    iterator res(at, at_index);
+    if (at_index == at->count) {
+      // the successor is a separator above, or there is none
+      res = iterator(at, at_index - 1);
+      ++res;
+    }
+    if (from_inner) {
+      // the erased key was replaced by the one found above
+      --res;
+    }
+    return res;
+  }
+
+  // moves the last key of the left sibling of par->children[p] through par
+  static void borrow_left(inner* par, size_t p) noexcept {
+    node* nd = par->children[p];
+    node* left = par->children[p - 1];
+    if (!nd->leaf) {
+      inner* to = static_cast<inner*>(nd);
+      for (size_t j = nd->count + 1; j > 0; j--) {
+        attach(to, j, to->children[j - 1]);
+      }
+      attach(to, 0, static_cast<inner*>(left)->children[left->count]);
+      static_cast<inner*>(left)->children[left->count] = nullptr;
+    }
+    construct_key(nd, nd->count, std::move(keys(par)[p - 1]));
+    nd->count++;
+    std::rotate(keys(nd), keys(nd) + nd->count - 1, keys(nd) + nd->count);
+    keys(par)[p - 1] = std::move(keys(left)[left->count - 1]);
+    destroy_keys(left, left->count - 1, left->count);
+    left->count--;
+  }
+
+  // moves the first key of the right sibling of par->children[p] through par
+  static void borrow_right(inner* par, size_t p) noexcept {
+    node* nd = par->children[p];
+    node* right = par->children[p + 1];
+    construct_key(nd, nd->count, std::move(keys(par)[p]));
+    keys(par)[p] = std::move(keys(right)[0]);
+    std::move(keys(right) + 1, keys(right) + right->count, keys(right));
+    destroy_keys(right, right->count - 1, right->count);
+    if (!nd->leaf) {
+      inner* from = static_cast<inner*>(right);
+      attach(static_cast<inner*>(nd), nd->count + 1, from->children[0]);
+      for (size_t j = 0; j < right->count; j++) {
+        attach(from, j, from->children[j + 1]);
+      }
+      from->children[right->count] = nullptr;
+    }
+    nd->count++;
+    right->count--;
+  }
+
+  // appends the separator keys(par)[p] and children[p + 1] to children[p]
+  void merge(inner* par, size_t p) noexcept {
+    node* nd = par->children[p];
+    node* right = par->children[p + 1];
+    size_t base = nd->count;
+    construct_key(nd, base, std::move(keys(par)[p]));
+    for (size_t j = 0; j < right->count; j++) {
+      construct_key(nd, base + 1 + j, std::move(keys(right)[j]));
+    }
+    if (!nd->leaf) {
+      inner* from = static_cast<inner*>(right);
+      for (size_t j = 0; j <= right->count; j++) {
+        attach(static_cast<inner*>(nd), base + 1 + j, from->children[j]);
+        from->children[j] = nullptr;
+      }
+    }
+    nd->count = static_cast<uint16_t>(base + 1 + right->count);
+    destroy_keys(right, 0, right->count);
+    right->count = 0;
+    delete_node(right);
+
+    std::move(keys(par) + p + 1, keys(par) + par->count, keys(par) + p);
+    destroy_keys(par, par->count - 1, par->count);
+    for (size_t j = p + 1; j < par->count; j++) {
+      attach(par, j, par->children[j + 1]);
+    }
+    par->children[par->count] = nullptr;
+    par->count--;
+  }
+
+  static void attach(inner* par, size_t j, node* child) noexcept {
+    par->children[j] = child;
+    child->parent = par;
+    child->position = static_cast<uint16_t>(j);
+  }
+
+  template <typename V>
+  static void construct_key(node* nd, size_t j, V&& val) {
+    new (&keys(nd)[j]) T(std::forward<V>(val));
+  }
+
+  static void destroy_keys(node* nd, size_t first, size_t last) noexcept {
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      for (size_t j = first; j < last; j++) {
+        keys(nd)[j].~T();
+      }
+    }
+  }
+
+  node* new_leaf() {
+    leaf_allocator alloc_leaf(alloc);
+    leaf_node* res = leaf_traits::allocate(alloc_leaf, 1);
+    leaf_traits::construct(alloc_leaf, res);
+    return res;
+  }
+
+  inner* new_inner() {
+    inner_allocator alloc_inner(alloc);
+    inner* res = inner_traits::allocate(alloc_inner, 1);
+    inner_traits::construct(alloc_inner, res);
+    return res;
+  }
+
+  void delete_node(node* nd) noexcept {
+    if (nd->leaf) {
+      leaf_allocator alloc_leaf(alloc);
+      leaf_traits::destroy(alloc_leaf, static_cast<leaf_node*>(nd));
+      leaf_traits::deallocate(alloc_leaf, static_cast<leaf_node*>(nd), 1);
+    } else {
+      inner_allocator alloc_inner(alloc);
+      inner_traits::destroy(alloc_inner, static_cast<inner*>(nd));
+      inner_traits::deallocate(alloc_inner, static_cast<inner*>(nd), 1);
+    }
+  }
+
+  // the height is logarithmic with a large base, recursion is fine here
+  void free_tree(node* nd) noexcept {
+    if (!nd->leaf) {
+      for (node* child : static_cast<inner*>(nd)->children) {
+        if (child != nullptr) {
+          free_tree(child);
+        }
+      }
+    }
+    destroy_keys(nd, 0, nd->count);
+    delete_node(nd);
+  }
+
+  node* clone(const node* src, inner* parent) {
+    node* res = src->leaf ? new_leaf() : new_inner();
+    res->parent = parent;
+    res->position = src->position;
+    try {
+      for (; res->count < src->count; res->count++) {
+        construct_key(res, res->count, keys(src)[res->count]);
+      }
+      if (!src->leaf) {
+        for (size_t j = 0; j <= src->count; j++) {
+          static_cast<inner*>(res)->children[j] = clone(static_cast<const inner*>(src)->children[j], static_cast<inner*>(res));
+        }
+      }
+    } catch (...) {
+      free_tree(res);
+      throw;
+    }
+    return res;
+  }
+
+  static void measure(const node* nd, size_t depth, tree_shape& res, size_t& total_depth) noexcept {
+    res.height = std::max(res.height, depth);
+    total_depth += depth * nd->count;
+    res.node_bytes += nd->leaf ? sizeof(leaf_node) : sizeof(inner);
+    if (!nd->leaf) {
+      for (size_t j = 0; j <= nd->count; j++) {
+        measure(static_cast<const inner*>(nd)->children[j], depth + 1, res, total_depth);
+      }
+    }
+  }
+
+  // Adds val, greater than every key, at the right edge. The last leaf is
+  // filled up, then val goes up as the separator before a new right edge,
+  // so the nodes left behind are full and only the edge may be underfull
+  // until finish_append(). Strong: the nodes are allocated and val copied
+  // before anything is linked. Returns the added key, which stays in place
+  // until finish_append().
+  template <typename V>
+  const T& append(V&& val) {
+    if (root == nullptr) {
+      root = leftmost = rightmost = new_leaf();
+    }
+    node* nd = rightmost;
+    if (nd->count < leaf_slots) {
+      construct_key(nd, nd->count, std::forward<V>(val));
+      size_set++;
+      return keys(nd)[nd->count++];
+    }
+
+    // a new leaf, a new inner node under every full ancestor, and a new
+    // root if they all are full
+    node* spare[64] = {};
+    size_t levels = 0;
+    inner* par = nd->parent;
+    inner* top = nullptr;
+    try {
+      spare[levels++] = new_leaf();
+      for (; par != nullptr && par->count == inner_slots; par = par->parent) {
+        spare[levels++] = new_inner();
+      }
+      if (par == nullptr) {
+        par = top = new_inner();
+      }
+      construct_key(par, par->count, std::forward<V>(val));
+    } catch (...) {
+      for (size_t j = 0; j < levels; j++) {
+        delete_node(spare[j]);
+      }
+      if (top != nullptr) {
+        delete_node(top);
+      }
+      throw;
+    }
+    if (top != nullptr) {
+      attach(top, 0, root);
+      root = top;
+    }
+    for (size_t j = 1; j < levels; j++) {
+      attach(static_cast<inner*>(spare[j]), 0, spare[j - 1]);
+    }
+    attach(par, par->count + 1, spare[levels - 1]);
+    size_set++;
+    rightmost = spare[0];
+    return keys(par)[par->count++];
+  }
+
+  // Tops up the nodes of the right edge with keys from their left
+  // siblings, which append() left full.
+  void finish_append() noexcept {
+    for (node* nd = root; nd != nullptr && !nd->leaf; nd = static_cast<inner*>(nd)->children[nd->count]) {
+      node* child = static_cast<inner*>(nd)->children[nd->count];
+      while (child->count < min_keys(child)) {
+        borrow_left(static_cast<inner*>(nd), nd->count);
+      }
+    }
+    update_ends();
+  }
+
+  void update_ends() noexcept {
+    leftmost = rightmost = root;
+    if (root == nullptr) {
+      return;
+    }
+    while (!leftmost->leaf) {
+      leftmost = static_cast<inner*>(leftmost)->children[0];
+    }
+    while (!rightmost->leaf) {
+      rightmost = static_cast<inner*>(rightmost)->children[rightmost->count];
+    }
+  }
+
+  node* root = nullptr;
+  // first and last leaves, begin() and end() point into them
+  node* leftmost = nullptr;
+  node* rightmost = nullptr;
+  size_t size_set = 0;
+  [[no_unique_address]] Allocator alloc;
+  [[no_unique_address]] Compare comp;
+};
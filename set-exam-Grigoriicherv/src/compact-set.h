@@ -0,0 +1,814 @@
+#pragma once
+
+#include "tree-shape.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Red-black tree like set, with nodes kept in one growable array and
+// linked by 32-bit indices instead of pointers. The colour lives in the
+// top bit of the parent index, so an int takes a 16-byte slot rather
+// than the 32-byte node of set<int> plus the heap's header, 48 bytes with
+// glibc malloc. The array grows by half when full, so it holds at most
+// 1.5 slots per element of the largest size the set has had, 24 bytes
+// for an int, and exactly one after shrink_to_fit(). While growing, the
+// old and the new array are both allocated. Erased slots are reused.
+// Iterators point into the array's bookkeeping, not the set object, so
+// they stay valid through growth, swap and move, as for set; pointers and
+// references to elements do not survive growth. end() of a set that has
+// never held an element is invalidated by the first insertion. At most
+// 2^31 - 2 elements.
+template <typename T, typename Compare = std::less<T>>
+class compact_set {
+  using index = uint32_t;
+
+  // slot 0 plays the fake node of set: the root is its left child and it
+  // is the root's parent, index 0 in child links means no child
+  static constexpr index NIL = 0;
+  static constexpr index RED = index(1) << 31;
+  static constexpr index INDEX = RED - 1;
+  // parent word of a slot on the free list, whose next is in left
+  static constexpr index FREE = ~index(0);
+
+  static constexpr size_t MIN_CAPACITY = 16;
+
+  static constexpr bool transparent = requires { typename Compare::is_transparent; };
+
+  struct slot {
+    alignas(T) unsigned char storage[sizeof(T)];
+    index left;
+    index right;
+    // parent index with the colour in the top bit
+    index up;
+
+    T& val() noexcept {
+      return *std::launder(reinterpret_cast<T*>(storage));
+    }
+
+    const T& val() const noexcept {
+      return *std::launder(reinterpret_cast<const T*>(storage));
+    }
+  };
+
+  using slot_allocator = std::allocator<slot>;
+
+  // The slots and their bookkeeping. It lives apart from the set and is
+  // handed over by swap and move, so that iterators, which point here,
+  // follow the elements. Allocated on the first insertion.
+  struct arena {
+    slot* slots = nullptr;
+    index allocated = 0;
+    // slots below used have been handed out at least once
+    index used = 0;
+    index free_list = NIL;
+
+    index find_min(index cur) const noexcept {
+      while (slots[cur].left != NIL) {
+        cur = slots[cur].left;
+      }
+      return cur;
+    }
+
+    index find_max(index cur) const noexcept {
+      while (slots[cur].right != NIL) {
+        cur = slots[cur].right;
+      }
+      return cur;
+    }
+
+    // the fake slot is the root's parent with the root on its left, so
+    // climbing from the maximum ends at NIL == end()
+    index next(index cur) const noexcept {
+      if (slots[cur].right != NIL) {
+        return find_min(slots[cur].right);
+      }
+      index p = slots[cur].up & INDEX;
+      while (p != NIL && slots[p].right == cur) {
+        cur = p;
+        p = slots[cur].up & INDEX;
+      }
+      return p;
+    }
+
+    index prev(index cur) const noexcept {
+      if (slots[cur].left != NIL) {
+        return find_max(slots[cur].left);
+      }
+      index p = slots[cur].up & INDEX;
+      while (p != NIL && slots[p].left == cur) {
+        cur = p;
+        p = slots[cur].up & INDEX;
+      }
+      return p;
+    }
+  };
+
+  template <typename R>
+  struct my_iterator {
+    friend class compact_set;
+
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const R*;
+    using reference = const R&;
+
+    my_iterator() = default;
+
+    my_iterator& operator++() {
+      i = store->next(i);
+      return *this;
+    }
+
+    my_iterator operator++(int) {
+      my_iterator x = *this;
+      ++*this;
+      return x;
+    }
+
+    my_iterator& operator--() {
+      i = store->prev(i);
+      return *this;
+    }
+
+    my_iterator operator--(int) {
+      my_iterator x = *this;
+      --*this;
+      return x;
+    }
+
+    const R& operator*() const {
+      return store->slots[i].val();
+    }
+
+    const R* operator->() const {
+      return &store->slots[i].val();
+    }
+
+    friend bool operator==(my_iterator const& a, my_iterator const& b) {
+      return a.store == b.store && a.i == b.i;
+    }
+
+    friend bool operator!=(my_iterator const& a, my_iterator const& b) {
+      return !(a == b);
+    }
+
+  private:
+    my_iterator(const arena* store, index i) : store(store), i(i) {}
+
+    const arena* store = nullptr;
+    // slot of the element, NIL for end()
+    index i = NIL;
+  };
+
+public:
+  using value_type = T;
+
+  using reference = T&;
+  using const_reference = const T&;
+
+  using pointer = T*;
+  using const_pointer = const T*;
+
+  using iterator = my_iterator<T>;
+  using const_iterator = my_iterator<T>;
+
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  using key_compare = Compare;
+  using value_compare = Compare;
+
+  // O(1) nothrow
+  compact_set() noexcept(std::is_nothrow_default_constructible_v<Compare>) = default;
+
+  // O(1)
+  explicit compact_set(const Compare& comp) : comp(comp) {}
+
+  // O(n) strong, slots are copied to the same indices
+  compact_set(const compact_set& other) : comp(other.comp) {
+    if (other.store == nullptr) {
+      return;
+    }
+    std::unique_ptr<arena> copy(new arena(*other.store));
+    copy->slots = slot_allocator().allocate(copy->used);
+    index built = 0;
+    try {
+      for (; built < copy->used; ++built) {
+        copy->slots[built].left = other.store->slots[built].left;
+        copy->slots[built].right = other.store->slots[built].right;
+        copy->slots[built].up = other.store->slots[built].up;
+        if (built != NIL && other.store->slots[built].up != FREE) {
+          ::new (static_cast<void*>(copy->slots[built].storage)) T(other.store->slots[built].val());
+        }
+      }
+    } catch (...) {
+      destroy_values(copy->slots, built);
+      slot_allocator().deallocate(copy->slots, copy->used);
+      throw;
+    }
+    copy->allocated = copy->used;
+    store = copy.release();
+    size_set = other.size_set;
+  }
+
+  // O(1) nothrow, iterators of other stay valid and refer to this set
+  compact_set(compact_set&& other) noexcept
+      : store(std::exchange(other.store, nullptr)), size_set(std::exchange(other.size_set, 0)), comp(other.comp) {}
+
+  // O(n) strong
+  compact_set& operator=(const compact_set& other) {
+    compact_set tmp(other);
+    swap(tmp, *this);
+    return *this;
+  }
+
+  // O(n) nothrow
+  compact_set& operator=(compact_set&& other) noexcept {
+    compact_set tmp(std::move(other));
+    swap(tmp, *this);
+    return *this;
+  }
+
+  // O(n) nothrow
+  ~compact_set() noexcept {
+    if (store != nullptr) {
+      destroy_values(store->slots, store->used);
+      slot_allocator().deallocate(store->slots, store->allocated);
+      delete store;
+    }
+  }
+
+  // O(n) nothrow, keeps the capacity
+  void clear() noexcept {
+    if (store == nullptr) {
+      return;
+    }
+    destroy_values(store->slots, store->used);
+    store->used = 1;
+    store->free_list = NIL;
+    size_set = 0;
+    store->slots[0] = slot{{}, NIL, NIL, NIL};
+  }
+
+  // O(n) strong, room for n elements without growing
+  void reserve(size_t n) {
+    if (n > INDEX - 1) {
+      throw std::length_error("compact_set::reserve");
+    }
+    if (n + 1 > allocated()) {
+      grow(static_cast<index>(n + 1));
+    }
+  }
+
+  // O(n) strong, gives back the slots past the last one in use. Erased
+  // slots below it stay on the free list, as moving elements down would
+  // invalidate their iterators.
+  void shrink_to_fit() {
+    if (store != nullptr && store->used < store->allocated) {
+      grow(store->used);
+    }
+  }
+
+  // O(1) nothrow, elements that fit without growing
+  size_t capacity() const noexcept {
+    return allocated() == 0 ? 0 : allocated() - 1;
+  }
+
+  // O(n) nothrow, height and mean depth of the tree, node_bytes counts
+  // the whole array, unused slots included
+  tree_shape shape() const noexcept {
+    tree_shape res{size_set, 0, 0, allocated() * sizeof(slot)};
+    if (size_set == 0) {
+      return res;
+    }
+    size_t depth = 1;
+    size_t total_depth = 0;
+    index nd = root();
+    while (left(nd) != NIL) {
+      nd = left(nd);
+      depth++;
+    }
+    while (nd != NIL) {
+      total_depth += depth;
+      res.height = std::max(res.height, depth);
+      if (right(nd) != NIL) {
+        nd = right(nd);
+        depth++;
+        while (left(nd) != NIL) {
+          nd = left(nd);
+          depth++;
+        }
+      } else {
+        while (right(parent(nd)) == nd) {
+          nd = parent(nd);
+          depth--;
+        }
+        nd = parent(nd);
+        depth--;
+      }
+    }
+    res.average_depth = static_cast<double>(total_depth) / static_cast<double>(size_set);
+    return res;
+  }
+
+  // O(1) nothrow
+  size_t size() const noexcept {
+    return size_set;
+  }
+
+  // O(1) nothrow
+  bool empty() const noexcept {
+    return size_set == 0;
+  }
+
+  key_compare key_comp() const {
+    return comp;
+  }
+
+  value_compare value_comp() const {
+    return comp;
+  }
+
+  // O(log n) nothrow
+  const_iterator begin() const noexcept {
+    index r = root();
+    return const_iterator(store, r == NIL ? NIL : find_min(r));
+  }
+
+  // O(1) nothrow
+  const_iterator end() const noexcept {
+    return const_iterator(store, NIL);
+  }
+
+  // O(1) nothrow
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+
+  // O(log n) nothrow
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+
+  // amortized O(log n) strong
+  std::pair<iterator, bool> insert(const T& val) {
+    return inserting(val);
+  }
+
+  // amortized O(log n) strong, val is left untouched if not inserted
+  std::pair<iterator, bool> insert(T&& val) {
+    return inserting(std::move(val));
+  }
+
+  // amortized O(log n) strong, the value is built before the search
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    return inserting(T(std::forward<Args>(args)...));
+  }
+
+  // O(log n) nothrow
+  iterator erase(const_iterator pos) {
+    index res = next(pos.i);
+    erase_node(pos.i);
+    release(pos.i);
+    return iterator(store, res);
+  }
+
+  // O(log n) strong
+  size_t erase(const T& val) {
+    return erasing(val);
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent && (!std::is_convertible_v<const K&, const_iterator>)
+  size_t erase(const K& key) {
+    return erasing(key);
+  }
+
+  // O(log n) strong
+  const_iterator lower_bound(const T& val) const {
+    return const_iterator(store, bounding<false>(val));
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator lower_bound(const K& key) const {
+    return const_iterator(store, bounding<false>(key));
+  }
+
+  // O(log n) strong
+  const_iterator upper_bound(const T& val) const {
+    return const_iterator(store, bounding<true>(val));
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator upper_bound(const K& key) const {
+    return const_iterator(store, bounding<true>(key));
+  }
+
+  // O(log n) strong
+  const_iterator find(const T& val) const {
+    return const_iterator(store, finding(val));
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator find(const K& key) const {
+    return const_iterator(store, finding(key));
+  }
+
+  // O(1) nothrow
+  friend void swap(compact_set& a, compact_set& b) noexcept {
+    using std::swap;
+    swap(a.comp, b.comp);
+    std::swap(a.store, b.store);
+    std::swap(a.size_set, b.size_set);
+  }
+
+private:
+  // Slot access. The fake slot is never red, so is_red(NIL) is false for
+  // missing children as well.
+
+  index& left(index i) const noexcept {
+    return store->slots[i].left;
+  }
+
+  index& right(index i) const noexcept {
+    return store->slots[i].right;
+  }
+
+  index parent(index i) const noexcept {
+    return store->slots[i].up & INDEX;
+  }
+
+  void set_parent(index i, index p) const noexcept {
+    store->slots[i].up = (store->slots[i].up & RED) | p;
+  }
+
+  bool is_red(index i) const noexcept {
+    return (store->slots[i].up & RED) != 0;
+  }
+
+  void set_red(index i, bool red) const noexcept {
+    store->slots[i].up = (store->slots[i].up & INDEX) | (red ? RED : 0);
+  }
+
+  index root() const noexcept {
+    return store == nullptr ? NIL : store->slots[0].left;
+  }
+
+  const T& val(index i) const noexcept {
+    return store->slots[i].val();
+  }
+
+  index allocated() const noexcept {
+    return store == nullptr ? 0 : store->allocated;
+  }
+
+  static void destroy_values(slot* arr, index count) noexcept {
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      for (index i = 1; i < count; ++i) {
+        if (arr[i].up != FREE) {
+          arr[i].val().~T();
+        }
+      }
+    }
+  }
+
+  // moves the slots to an array of new_capacity, which holds all slots
+  // in use, strong: values are only moved if that cannot throw
+  void grow(index new_capacity) {
+    std::unique_ptr<arena> fresh(store == nullptr ? new arena : nullptr);
+    arena* target = store == nullptr ? fresh.get() : store;
+    slot* moved = slot_allocator().allocate(new_capacity);
+    index built = 0;
+    try {
+      for (; built < target->used; ++built) {
+        moved[built].left = target->slots[built].left;
+        moved[built].right = target->slots[built].right;
+        moved[built].up = target->slots[built].up;
+        if (built != NIL && target->slots[built].up != FREE) {
+          ::new (static_cast<void*>(moved[built].storage)) T(std::move_if_noexcept(target->slots[built].val()));
+        }
+      }
+    } catch (...) {
+      destroy_values(moved, built);
+      slot_allocator().deallocate(moved, new_capacity);
+      throw;
+    }
+    if (target->slots == nullptr) {
+      moved[0] = slot{{}, NIL, NIL, NIL};
+      target->used = 1;
+    } else {
+      destroy_values(target->slots, target->used);
+      slot_allocator().deallocate(target->slots, target->allocated);
+    }
+    target->slots = moved;
+    target->allocated = new_capacity;
+    if (fresh != nullptr) {
+      store = fresh.release();
+    }
+  }
+
+  // an unused slot, growing the array by half if there is none
+  index acquire() {
+    if (store != nullptr && store->free_list != NIL) {
+      return store->free_list;
+    }
+    index have = allocated();
+    if (store == nullptr || store->used == have) {
+      if (have == INDEX) {
+        throw std::length_error("compact_set is full");
+      }
+      grow(have > INDEX / 3 * 2 ? INDEX : std::max<index>(have + have / 2, MIN_CAPACITY));
+    }
+    return store->used;
+  }
+
+  // marks a slot returned by acquire() as taken, nothrow
+  void take(index i) noexcept {
+    if (i == store->free_list) {
+      store->free_list = left(i);
+    } else {
+      store->used++;
+    }
+  }
+
+  // destroys the value of an unlinked slot and puts it on the free list
+  void release(index i) noexcept {
+    store->slots[i].val().~T();
+    store->slots[i].left = store->free_list;
+    store->slots[i].up = FREE;
+    store->free_list = i;
+  }
+
+  template <typename V>
+  std::pair<iterator, bool> inserting(V&& val) {
+    index par = NIL;
+    bool go_left = true;
+    for (index cur = root(); cur != NIL;) {
+      par = cur;
+      if (comp(val, this->val(cur))) {
+        go_left = true;
+        cur = left(cur);
+      } else if (comp(this->val(cur), val)) {
+        go_left = false;
+        cur = right(cur);
+      } else {
+        return {iterator(store, cur), false};
+      }
+    }
+    index nd = acquire();
+    ::new (static_cast<void*>(store->slots[nd].storage)) T(std::forward<V>(val));
+    take(nd);
+    store->slots[nd].left = store->slots[nd].right = NIL;
+    store->slots[nd].up = par | RED;
+    (go_left ? left(par) : right(par)) = nd;
+    insert_fixup(nd);
+    size_set++;
+    return {iterator(store, nd), true};
+  }
+
+  template <typename K>
+  size_t erasing(const K& key) {
+    index nd = finding(key);
+    if (nd == NIL) {
+      return 0;
+    }
+    erase_node(nd);
+    release(nd);
+    return 1;
+  }
+
+  // The red-black algorithms of set, on indices.
+
+  void rotate_left(index x) noexcept {
+    index y = right(x);
+    index p = parent(x);
+    right(x) = left(y);
+    if (left(y) != NIL) {
+      set_parent(left(y), x);
+    }
+    set_parent(y, p);
+    if (left(p) == x) {
+      left(p) = y;
+    } else {
+      right(p) = y;
+    }
+    left(y) = x;
+    set_parent(x, y);
+  }
+
+  void rotate_right(index x) noexcept {
+    index y = left(x);
+    index p = parent(x);
+    left(x) = right(y);
+    if (right(y) != NIL) {
+      set_parent(right(y), x);
+    }
+    set_parent(y, p);
+    if (left(p) == x) {
+      left(p) = y;
+    } else {
+      right(p) = y;
+    }
+    right(y) = x;
+    set_parent(x, y);
+  }
+
+  void insert_fixup(index nd) noexcept {
+    while (is_red(parent(nd))) {
+      index par = parent(nd);
+      index grand = parent(par);
+      if (par == left(grand)) {
+        index uncle = right(grand);
+        if (is_red(uncle)) {
+          set_red(par, false);
+          set_red(uncle, false);
+          set_red(grand, true);
+          nd = grand;
+          continue;
+        }
+        if (nd == right(par)) {
+          rotate_left(par);
+          std::swap(nd, par);
+        }
+        set_red(par, false);
+        set_red(grand, true);
+        rotate_right(grand);
+      } else {
+        index uncle = left(grand);
+        if (is_red(uncle)) {
+          set_red(par, false);
+          set_red(uncle, false);
+          set_red(grand, true);
+          nd = grand;
+          continue;
+        }
+        if (nd == left(par)) {
+          rotate_right(par);
+          std::swap(nd, par);
+        }
+        set_red(par, false);
+        set_red(grand, true);
+        rotate_left(grand);
+      }
+    }
+    set_red(root(), false);
+  }
+
+  void transplant(index from, index to) noexcept {
+    index p = parent(from);
+    if (left(p) == from) {
+      left(p) = to;
+    } else {
+      right(p) = to;
+    }
+    if (to != NIL) {
+      set_parent(to, p);
+    }
+  }
+
+  void erase_node(index nd) noexcept {
+    bool removed_red = is_red(nd);
+    index child;
+    index child_parent;
+    if (left(nd) == NIL) {
+      child = right(nd);
+      child_parent = parent(nd);
+      transplant(nd, right(nd));
+    } else if (right(nd) == NIL) {
+      child = left(nd);
+      child_parent = parent(nd);
+      transplant(nd, left(nd));
+    } else {
+      index removed = find_min(right(nd));
+      removed_red = is_red(removed);
+      child = right(removed);
+      if (parent(removed) == nd) {
+        child_parent = removed;
+      } else {
+        child_parent = parent(removed);
+        transplant(removed, right(removed));
+        right(removed) = right(nd);
+        set_parent(right(removed), removed);
+      }
+      transplant(nd, removed);
+      left(removed) = left(nd);
+      set_parent(left(removed), removed);
+      set_red(removed, is_red(nd));
+    }
+    size_set--;
+    if (!removed_red) {
+      erase_fixup(child, child_parent);
+    }
+  }
+
+  void erase_fixup(index nd, index par) noexcept {
+    while (nd != root() && !is_red(nd)) {
+      if (nd == left(par)) {
+        index sibling = right(par);
+        if (is_red(sibling)) {
+          set_red(sibling, false);
+          set_red(par, true);
+          rotate_left(par);
+          sibling = right(par);
+        }
+        if (!is_red(left(sibling)) && !is_red(right(sibling))) {
+          set_red(sibling, true);
+          nd = par;
+          par = parent(nd);
+          continue;
+        }
+        if (!is_red(right(sibling))) {
+          set_red(left(sibling), false);
+          set_red(sibling, true);
+          rotate_right(sibling);
+          sibling = right(par);
+        }
+        set_red(sibling, is_red(par));
+        set_red(par, false);
+        set_red(right(sibling), false);
+        rotate_left(par);
+      } else {
+        index sibling = left(par);
+        if (is_red(sibling)) {
+          set_red(sibling, false);
+          set_red(par, true);
+          rotate_right(par);
+          sibling = left(par);
+        }
+        if (!is_red(left(sibling)) && !is_red(right(sibling))) {
+          set_red(sibling, true);
+          nd = par;
+          par = parent(nd);
+          continue;
+        }
+        if (!is_red(left(sibling))) {
+          set_red(right(sibling), false);
+          set_red(sibling, true);
+          rotate_left(sibling);
+          sibling = left(par);
+        }
+        set_red(sibling, is_red(par));
+        set_red(par, false);
+        set_red(left(sibling), false);
+        rotate_right(par);
+      }
+      nd = root();
+    }
+    if (nd != NIL) {
+      set_red(nd, false);
+    }
+  }
+
+  template <bool Upper, typename K>
+  index bounding(const K& key) const {
+    index res = NIL;
+    for (index cur = root(); cur != NIL;) {
+      if (Upper ? comp(key, val(cur)) : !comp(val(cur), key)) {
+        res = cur;
+        cur = left(cur);
+      } else {
+        cur = right(cur);
+      }
+    }
+    return res;
+  }
+
+  template <typename K>
+  index finding(const K& key) const {
+    index res = bounding<false>(key);
+    if (res == NIL || comp(key, val(res))) {
+      return NIL;
+    }
+    return res;
+  }
+
+  index find_min(index cur) const noexcept {
+    return store->find_min(cur);
+  }
+
+  index next(index cur) const noexcept {
+    return store->next(cur);
+  }
+
+  // nullptr until the first insertion
+  arena* store = nullptr;
+  size_t size_set = 0;
+  [[no_unique_address]] Compare comp;
+};
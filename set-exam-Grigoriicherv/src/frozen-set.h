@@ -0,0 +1,352 @@
+#pragma once
+
+#include "mapped-file.h"
+#include "sorted-unique.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename T, typename Compare, typename Allocator, bool OrderStatistics, bool Threaded>
+class set;
+
+// Immutable sorted set in Eytzinger layout: keys are stored in BFS order of
+// a complete binary search tree, the children of slot j are 2j and 2j + 1.
+// A lookup descends without branches on the comparison result and
+// prefetches the cache line holding all descendants a few levels below,
+// e.g. the 16 descendants four levels down for 4-byte keys.
+// Iteration walks the implicit tree in order, amortized O(1) per step.
+template <typename T, typename Compare = std::less<T>>
+class frozen_set {
+  static constexpr size_t CACHE_LINE = 64;
+
+  static constexpr bool transparent = requires { typename Compare::is_transparent; };
+
+  template <typename R>
+  struct my_iterator {
+    friend class frozen_set;
+
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const R*;
+    using reference = const R&;
+
+    my_iterator() = default;
+
+    my_iterator& operator++() {
+      if (2 * j + 1 <= n) {
+        j = 2 * j + 1;
+        while (2 * j <= n) {
+          j = 2 * j;
+        }
+      } else {
+        // climb while coming from a right child, the root leads to 0 == end
+        j >>= std::countr_one(j) + 1;
+      }
+      return *this;
+    }
+
+    my_iterator operator++(int) {
+      my_iterator x = *this;
+      ++*this;
+      return x;
+    }
+
+    my_iterator& operator--() {
+      if (j == 0) {
+        j = std::bit_floor(n + 1) - 1;
+      } else if (2 * j <= n) {
+        j = 2 * j;
+        while (2 * j + 1 <= n) {
+          j = 2 * j + 1;
+        }
+      } else {
+        j >>= std::countr_zero(j) + 1;
+      }
+      return *this;
+    }
+
+    my_iterator operator--(int) {
+      my_iterator x = *this;
+      --*this;
+      return x;
+    }
+
+    const R& operator*() const {
+      return slots[j];
+    }
+
+    const R* operator->() const {
+      return &slots[j];
+    }
+
+    friend bool operator==(my_iterator const& a, my_iterator const& b) {
+      return a.j == b.j;
+    }
+
+    friend bool operator!=(my_iterator const& a, my_iterator const& b) {
+      return a.j != b.j;
+    }
+
+  private:
+    my_iterator(const T* slots, size_t n, size_t j) : slots(slots), n(n), j(j) {}
+
+    const T* slots = nullptr;
+    size_t n = 0;
+    // slot of the element, 0 is end()
+    size_t j = 0;
+  };
+
+public:
+  using value_type = T;
+
+  using reference = T&;
+  using const_reference = const T&;
+
+  using pointer = T*;
+  using const_pointer = const T*;
+
+  using iterator = my_iterator<T>;
+  using const_iterator = my_iterator<T>;
+
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  using key_compare = Compare;
+  using value_compare = Compare;
+
+  // O(1) nothrow
+  frozen_set() noexcept(std::is_nothrow_default_constructible_v<Compare>) = default;
+
+  // O(n) strong, [first, last) must be strictly increasing
+  template <std::forward_iterator It>
+  frozen_set(sorted_unique_t, It first, It last, const Compare& comp = Compare())
+      : frozen_set(sorted_unique, first, last, static_cast<size_t>(std::distance(first, last)), comp) {}
+
+  // O(n) strong
+  frozen_set(const frozen_set& other) : frozen_set(sorted_unique, other.begin(), other.end(), other.n, other.comp) {}
+
+  // O(1) nothrow
+  frozen_set(frozen_set&& other) noexcept
+      : slots(std::exchange(other.slots, nullptr)), n(std::exchange(other.n, 0)), comp(other.comp) {}
+
+  // O(n) strong
+  frozen_set& operator=(const frozen_set& other) {
+    frozen_set tmp(other);
+    swap(tmp, *this);
+    return *this;
+  }
+
+  // O(n) nothrow
+  frozen_set& operator=(frozen_set&& other) noexcept {
+    frozen_set tmp(std::move(other));
+    swap(tmp, *this);
+    return *this;
+  }
+
+  // O(n) nothrow
+  ~frozen_set() noexcept {
+    destroy(n);
+  }
+
+  // O(1) nothrow
+  size_t size() const noexcept {
+    return n;
+  }
+
+  // O(1) nothrow
+  bool empty() const noexcept {
+    return n == 0;
+  }
+
+  key_compare key_comp() const {
+    return comp;
+  }
+
+  value_compare value_comp() const {
+    return comp;
+  }
+
+  // O(log n) nothrow
+  const_iterator begin() const noexcept {
+    return const_iterator(slots, n, std::bit_floor(n));
+  }
+
+  // O(1) nothrow
+  const_iterator end() const noexcept {
+    return const_iterator(slots, n, 0);
+  }
+
+  // O(1) nothrow
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+
+  // O(log n) nothrow
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+
+  // O(log n) strong
+  const_iterator lower_bound(const T& val) const {
+    return const_iterator(slots, n, descend<false>(val));
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator lower_bound(const K& key) const {
+    return const_iterator(slots, n, descend<false>(key));
+  }
+
+  // O(log n) strong
+  const_iterator upper_bound(const T& val) const {
+    return const_iterator(slots, n, descend<true>(val));
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator upper_bound(const K& key) const {
+    return const_iterator(slots, n, descend<true>(key));
+  }
+
+  // O(log n) strong
+  const_iterator find(const T& val) const {
+    return finding(val);
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator find(const K& key) const {
+    return finding(key);
+  }
+
+  // O(n) strong, writes the keys in increasing order to a flat file that
+  // load() of frozen_set or set reads back, see save_keys()
+  void save(const std::filesystem::path& path) const requires std::is_trivially_copyable_v<T> {
+    save_keys<T>(path, begin(), end(), n);
+  }
+
+  // O(n) strong, the keys of a file written by save(), mapped into memory
+  // and copied into place without parsing
+  static frozen_set load(const std::filesystem::path& path,
+                         const Compare& comp = Compare()) requires std::is_trivially_copyable_v<T> {
+    mapped_keys<T> keys(path);
+    keys.check_increasing(comp);
+    return frozen_set(sorted_unique, keys.begin(), keys.end(), keys.size(), comp);
+  }
+
+  // O(1) nothrow
+  friend void swap(frozen_set& a, frozen_set& b) noexcept {
+    using std::swap;
+    swap(a.comp, b.comp);
+    std::swap(a.slots, b.slots);
+    std::swap(a.n, b.n);
+  }
+
+private:
+  template <typename, typename, typename, bool, bool>
+  friend class set;
+
+  // Places the i-th key at the i-th slot of an in-order walk of the
+  // implicit tree. Slot 0 is never constructed, it starts a cache line.
+  template <typename It>
+  frozen_set(sorted_unique_t, It first, It last, size_t count, const Compare& comp) : comp(comp) {
+    if (count == 0) {
+      return;
+    }
+    slots = static_cast<T*>(::operator new((count + 1) * sizeof(T), std::align_val_t(alignment())));
+    size_t built = 0;
+    try {
+      size_t j = std::bit_floor(count);
+      for (; first != last; ++first) {
+        new (slots + j) T(*first);
+        built++;
+        if (2 * j + 1 <= count) {
+          j = 2 * j + 1;
+          while (2 * j <= count) {
+            j = 2 * j;
+          }
+        } else {
+          j >>= std::countr_one(j) + 1;
+        }
+      }
+    } catch (...) {
+      n = count;
+      destroy(built);
+      throw;
+    }
+    n = count;
+  }
+
+  static constexpr size_t alignment() noexcept {
+    return std::max(alignof(T), CACHE_LINE);
+  }
+
+  // destroys the first `built` keys in in-order and frees the slots
+  void destroy(size_t built) noexcept {
+    if (slots == nullptr) {
+      return;
+    }
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      for (const_iterator it = begin(); built > 0; ++it, --built) {
+        slots[it.j].~T();
+      }
+    }
+    ::operator delete(slots, std::align_val_t(alignment()));
+    slots = nullptr;
+    n = 0;
+  }
+
+  // Slot of the first key not less than val (Upper: greater than val) or 0.
+  // The path is a bit string of comparison results; the answer is where the
+  // path last went left, found by stripping the trailing right turns.
+  template <bool Upper, typename K>
+  size_t descend(const K& val) const {
+    size_t j = 1;
+    while (j <= n) {
+      prefetch(j);
+      if constexpr (Upper) {
+        j = 2 * j + !comp(val, slots[j]);
+      } else {
+        j = 2 * j + comp(slots[j], val);
+      }
+    }
+    return j >> (std::countr_one(j) + 1);
+  }
+
+  template <typename K>
+  const_iterator finding(const K& val) const {
+    size_t j = descend<false>(val);
+    if (j == 0 || comp(val, slots[j])) {
+      return end();
+    }
+    return const_iterator(slots, n, j);
+  }
+
+  // The descendants of j that are log2(per_line) levels down fill slots
+  // [j * per_line, (j + 1) * per_line), which is exactly one cache line.
+  void prefetch([[maybe_unused]] size_t j) const noexcept {
+#if defined(__GNUC__)
+    if constexpr (sizeof(T) <= CACHE_LINE / 4 && std::has_single_bit(sizeof(T))) {
+      constexpr size_t per_line = CACHE_LINE / sizeof(T);
+      __builtin_prefetch(reinterpret_cast<const void*>(reinterpret_cast<uintptr_t>(slots) + j * per_line * sizeof(T)));
+    }
+#endif
+  }
+
+  T* slots = nullptr;
+  size_t n = 0;
+  [[no_unique_address]] Compare comp;
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_HAS_MMAP 1
+#endif
+
+// Flat file of keys as written by save() of the sets: a header, then the
+// raw bytes of count keys in increasing order, in the byte order of the
+// machine that wrote it. Keys start at a 64-byte offset, so they are
+// aligned in a mapping.
+struct keys_file_header {
+  static constexpr char MAGIC[8] = {'S', 'E', 'T', 'K', 'E', 'Y', 'S', '1'};
+
+  char magic[8];
+  uint64_t key_size;
+  uint64_t count;
+  char reserved[40];
+};
+
+static_assert(sizeof(keys_file_header) == 64);
+
+// writes the header and the keys to path, truncating it
+template <typename T, std::input_iterator It>
+void write_keys(const std::filesystem::path& path, It first, It last, size_t count) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  std::ofstream out;
+  out.exceptions(std::ios::failbit | std::ios::badbit);
+  out.open(path, std::ios::binary | std::ios::trunc);
+
+  keys_file_header header{};
+  std::memcpy(header.magic, keys_file_header::MAGIC, sizeof(header.magic));
+  header.key_size = sizeof(T);
+  header.count = count;
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  // keys are copied into a buffer, so that the stream sees large writes
+  constexpr size_t BATCH = ((1 << 16) / sizeof(T) + 1) * sizeof(T);
+  std::unique_ptr<char[]> buffer(new char[BATCH]);
+  size_t filled = 0;
+  for (; first != last; ++first) {
+    const T& key = *first;
+    std::memcpy(buffer.get() + filled, std::addressof(key), sizeof(T));
+    filled += sizeof(T);
+    if (filled == BATCH) {
+      out.write(buffer.get(), static_cast<std::streamsize>(filled));
+      filled = 0;
+    }
+  }
+  out.write(buffer.get(), static_cast<std::streamsize>(filled));
+  out.flush();
+  out.close();
+}
+
+// O(n) strong, writes count keys of [first, last) to path, replacing it.
+// The keys go to path.tmp next to it, which is renamed over path once
+// complete, so a failure leaves the old file as it was.
+template <typename T, std::input_iterator It>
+void save_keys(const std::filesystem::path& path, It first, It last, size_t count) {
+  std::filesystem::path tmp = path;
+  tmp += ".tmp";
+  try {
+    write_keys<T>(tmp, first, last, count);
+    std::filesystem::rename(tmp, path);
+  } catch (...) {
+    std::error_code ec;
+    std::filesystem::remove(tmp, ec);
+    throw;
+  }
+}
+
+// Read-only view of the keys of a file written by save_keys(). The file is
+// mapped into memory where possible, so nothing is parsed or copied and
+// the pages are read in as the keys are walked; elsewhere it is read into
+// a buffer. Throws std::system_error if the file cannot be read and
+// std::runtime_error if it is not a file of keys of type T.
+template <typename T>
+class mapped_keys {
+  static_assert(std::is_trivially_copyable_v<T>);
+  static_assert(alignof(T) <= sizeof(keys_file_header));
+
+public:
+  explicit mapped_keys(const std::filesystem::path& path) {
+#ifdef MAPPED_FILE_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), "open " + path.string());
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::generic_category(), "stat " + path.string());
+    }
+    length = static_cast<size_t>(st.st_size);
+    if (length < sizeof(keys_file_header)) {
+      ::close(fd);
+      throw std::runtime_error("not a file of keys: " + path.string());
+    }
+    void* addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      throw std::system_error(err, std::generic_category(), "mmap " + path.string());
+    }
+    ::madvise(addr, length, MADV_SEQUENTIAL);
+    data = static_cast<const char*>(addr);
+#else
+    std::ifstream in;
+    in.exceptions(std::ios::failbit | std::ios::badbit);
+    in.open(path, std::ios::binary | std::ios::ate);
+    length = static_cast<size_t>(in.tellg());
+    if (length < sizeof(keys_file_header)) {
+      throw std::runtime_error("not a file of keys: " + path.string());
+    }
+    // new[] of char gives storage aligned for any fundamental type
+    buffer.reset(new char[length]);
+    in.seekg(0);
+    in.read(buffer.get(), static_cast<std::streamsize>(length));
+    data = buffer.get();
+#endif
+    keys_file_header header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, keys_file_header::MAGIC, sizeof(header.magic)) != 0 ||
+        header.key_size != sizeof(T) || (length - sizeof(header)) / sizeof(T) != header.count ||
+        (length - sizeof(header)) % sizeof(T) != 0) {
+      unmap();
+      throw std::runtime_error("not a file of keys of this type: " + path.string());
+    }
+    n = static_cast<size_t>(header.count);
+  }
+
+  mapped_keys(const mapped_keys&) = delete;
+  mapped_keys& operator=(const mapped_keys&) = delete;
+
+  ~mapped_keys() {
+    unmap();
+  }
+
+  const T* begin() const noexcept {
+    return reinterpret_cast<const T*>(data + sizeof(keys_file_header));
+  }
+
+  const T* end() const noexcept {
+    return begin() + n;
+  }
+
+  size_t size() const noexcept {
+    return n;
+  }
+
+  // O(n), throws std::runtime_error unless the keys strictly increase
+  // under comp, as the sets need them to
+  template <typename Compare>
+  void check_increasing(const Compare& comp) const {
+    if (std::adjacent_find(begin(), end(), [&](const T& a, const T& b) { return !comp(a, b); }) != end()) {
+      throw std::runtime_error("keys of the file are not increasing");
+    }
+  }
+
+private:
+  void unmap() noexcept {
+#ifdef MAPPED_FILE_HAS_MMAP
+    ::munmap(const_cast<char*>(data), length);
+#endif
+  }
+
+  const char* data = nullptr;
+  size_t length = 0;
+  size_t n = 0;
+#ifndef MAPPED_FILE_HAS_MMAP
+  std::unique_ptr<char[]> buffer;
+#endif
+};
+
+#undef MAPPED_FILE_HAS_MMAP
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Whether copies of an allocator may allocate and deallocate on several
+// threads at once. std::allocator may; other allocators opt in with a
+// member is_thread_safe = std::true_type. Being always equal is not
+// enough: a stateless allocator may draw from a global pool without locks.
+template <typename Alloc>
+inline constexpr bool thread_safe_allocator = requires { requires Alloc::is_thread_safe::value; };
+
+template <typename T>
+inline constexpr bool thread_safe_allocator<std::allocator<T>> = true;
+
+// Runs f(0), ..., f(tasks - 1) each on its own thread, the last one on the
+// calling thread, and rethrows the first exception once all have ended.
+// If a thread cannot be started, the tasks from it on are not run.
+template <typename F>
+void parallel_for(size_t tasks, F f) {
+  std::vector<std::exception_ptr> errors(tasks);
+  auto run = [&](size_t i) {
+    try {
+      f(i);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> workers;
+  try {
+    workers.reserve(tasks);
+    for (size_t i = 0; i + 1 < tasks; ++i) {
+      workers.emplace_back(run, i);
+    }
+  } catch (...) {
+    for (std::thread& w : workers) {
+      w.join();
+    }
+    throw;
+  }
+  if (tasks > 0) {
+    run(tasks - 1);
+  }
+  for (std::thread& w : workers) {
+    w.join();
+  }
+  for (std::exception_ptr& e : errors) {
+    if (e) {
+      std::rethrow_exception(e);
+    }
+  }
+}
@@ -0,0 +1,657 @@
+#pragma once
+
+#include "tree-shape.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+template <typename T, typename Compare>
+class atomic_persistent_set;
+
+// Sorted set whose versions share structure: nodes are immutable and
+// reference counted, an update copies the O(log n) nodes on the path to
+// the changed one and leaves every other version untouched. Copies, and
+// so snapshots, are O(1). The tree is weight-balanced, each node knows the
+// size of its subtree.
+// Distinct objects may be used from different threads even when they
+// share nodes; atomic_persistent_set hands versions from a writer to
+// readers.
+template <typename T, typename Compare = std::less<T>>
+class persistent_set {
+  // balance parameters (3, 2) of Hirai and Yamamoto: a subtree is at most
+  // DELTA times heavier than its sibling, counting empty subtrees as 1
+  static constexpr size_t DELTA = 3;
+  static constexpr size_t RATIO = 2;
+
+  // a subtree weighs at most 3/4 of its parent, so this is enough for
+  // any tree that fits into memory
+  static constexpr size_t MAX_DEPTH = 144;
+
+  static constexpr bool transparent = requires { typename Compare::is_transparent; };
+
+  struct node {
+    template <typename... Args>
+    node(const node* left, const node* right, Args&&... args)
+        : val(std::forward<Args>(args)...),
+          left(left),
+          right(right),
+          size(1 + size_of(left) + size_of(right)) {}
+
+    T val;
+    const node* left;
+    const node* right;
+    size_t size;
+    mutable std::atomic<size_t> refs{1};
+  };
+
+  // owning handle of one reference to a node
+  class ref {
+  public:
+    ref() noexcept = default;
+
+    explicit ref(const node* ptr) noexcept : ptr(ptr) {}
+
+    ref(ref&& other) noexcept : ptr(std::exchange(other.ptr, nullptr)) {}
+
+    ref& operator=(ref&& other) noexcept {
+      ref tmp(std::move(other));
+      std::swap(ptr, tmp.ptr);
+      return *this;
+    }
+
+    ~ref() {
+      drop(ptr);
+    }
+
+    const node* get() const noexcept {
+      return ptr;
+    }
+
+    const node* operator->() const noexcept {
+      return ptr;
+    }
+
+    const node* release() noexcept {
+      return std::exchange(ptr, nullptr);
+    }
+
+  private:
+    const node* ptr = nullptr;
+  };
+
+  template <typename R>
+  struct my_iterator {
+    friend class persistent_set;
+
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const R*;
+    using reference = const R&;
+
+    my_iterator() = default;
+
+    my_iterator& operator++() {
+      const node* cur = path[depth - 1];
+      if (cur->right != nullptr) {
+        path[depth++] = cur->right;
+        leftmost();
+      } else {
+        // climb while coming from a right child, past the root is end()
+        do {
+          cur = path[--depth];
+        } while (depth > 0 && path[depth - 1]->right == cur);
+      }
+      return *this;
+    }
+
+    my_iterator operator++(int) {
+      my_iterator x = *this;
+      ++*this;
+      return x;
+    }
+
+    my_iterator& operator--() {
+      if (depth == 0) {
+        path[depth++] = root;
+        rightmost();
+        return *this;
+      }
+      const node* cur = path[depth - 1];
+      if (cur->left != nullptr) {
+        path[depth++] = cur->left;
+        rightmost();
+      } else {
+        do {
+          cur = path[--depth];
+        } while (path[depth - 1]->left == cur);
+      }
+      return *this;
+    }
+
+    my_iterator operator--(int) {
+      my_iterator x = *this;
+      --*this;
+      return x;
+    }
+
+    const R& operator*() const {
+      return path[depth - 1]->val;
+    }
+
+    const R* operator->() const {
+      return &path[depth - 1]->val;
+    }
+
+    friend bool operator==(my_iterator const& a, my_iterator const& b) {
+      return a.depth == b.depth && (a.depth == 0 || a.path[a.depth - 1] == b.path[b.depth - 1]);
+    }
+
+    friend bool operator!=(my_iterator const& a, my_iterator const& b) {
+      return !(a == b);
+    }
+
+  private:
+    explicit my_iterator(const node* root) : root(root) {}
+
+    void leftmost() {
+      while (path[depth - 1]->left != nullptr) {
+        path[depth] = path[depth - 1]->left;
+        depth++;
+      }
+    }
+
+    void rightmost() {
+      while (path[depth - 1]->right != nullptr) {
+        path[depth] = path[depth - 1]->right;
+        depth++;
+      }
+    }
+
+    const node* root = nullptr;
+    // nodes from the root to the element, empty for end()
+    const node* path[MAX_DEPTH];
+    size_t depth = 0;
+  };
+
+public:
+  using value_type = T;
+
+  using reference = T&;
+  using const_reference = const T&;
+
+  using pointer = T*;
+  using const_pointer = const T*;
+
+  using iterator = my_iterator<T>;
+  using const_iterator = my_iterator<T>;
+
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  using key_compare = Compare;
+  using value_compare = Compare;
+
+  // O(1) nothrow
+  persistent_set() noexcept(std::is_nothrow_default_constructible_v<Compare>) = default;
+
+  // O(1)
+  explicit persistent_set(const Compare& comp) : comp(comp) {}
+
+  // O(1) nothrow, shares every node with other
+  persistent_set(const persistent_set& other) : root(share(other.root.get())), comp(other.comp) {}
+
+  // O(1) nothrow
+  persistent_set(persistent_set&& other) noexcept = default;
+
+  // O(1) nothrow, plus freeing the nodes nobody else shares
+  persistent_set& operator=(const persistent_set& other) {
+    persistent_set tmp(other);
+    swap(tmp, *this);
+    return *this;
+  }
+
+  // O(1) nothrow, plus freeing the nodes nobody else shares
+  persistent_set& operator=(persistent_set&& other) noexcept {
+    persistent_set tmp(std::move(other));
+    swap(tmp, *this);
+    return *this;
+  }
+
+  // O(n) nothrow, only for the nodes nobody else shares
+  ~persistent_set() noexcept = default;
+
+  // O(1) nothrow, an unchangeable copy of the current version
+  persistent_set snapshot() const {
+    return *this;
+  }
+
+  // O(1) nothrow, plus freeing the nodes nobody else shares
+  void clear() noexcept {
+    root = ref();
+  }
+
+  // O(1) nothrow
+  size_t size() const noexcept {
+    return size_of(root.get());
+  }
+
+  // O(1) nothrow
+  bool empty() const noexcept {
+    return root.get() == nullptr;
+  }
+
+  key_compare key_comp() const {
+    return comp;
+  }
+
+  value_compare value_comp() const {
+    return comp;
+  }
+
+  // O(n) nothrow, height and mean depth of this version, node_bytes counts
+  // its nodes, including the ones shared with other versions
+  tree_shape shape() const noexcept {
+    tree_shape res{size(), 0, 0, size() * sizeof(node)};
+    if (root.get() == nullptr) {
+      return res;
+    }
+    size_t total_depth = 0;
+    measure(root.get(), 1, res.height, total_depth);
+    res.average_depth = static_cast<double>(total_depth) / static_cast<double>(res.size);
+    return res;
+  }
+
+  // O(log n) nothrow
+  const_iterator begin() const noexcept {
+    const_iterator it(root.get());
+    if (root.get() != nullptr) {
+      it.path[it.depth++] = root.get();
+      it.leftmost();
+    }
+    return it;
+  }
+
+  // O(1) nothrow
+  const_iterator end() const noexcept {
+    return const_iterator(root.get());
+  }
+
+  // O(1) nothrow
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+
+  // O(log n) nothrow
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+
+  // O(log n) strong, copies the path to the new element
+  std::pair<iterator, bool> insert(const T& val) {
+    return inserting(val, [&] { return make(ref(), ref(), val); });
+  }
+
+  // O(log n) strong, val is left untouched if not inserted
+  std::pair<iterator, bool> insert(T&& val) {
+    return inserting(val, [&] { return make(ref(), ref(), std::move(val)); });
+  }
+
+  // O(log n) strong, the value is built before the search
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    ref leaf = make(ref(), ref(), std::forward<Args>(args)...);
+    return inserting(leaf->val, [&] { return std::move(leaf); });
+  }
+
+  // O(log n) strong, copies the path to the erased element
+  size_t erase(const T& val) {
+    return erasing(val);
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  size_t erase(const K& key) {
+    return erasing(key);
+  }
+
+  // O(log n) strong
+  const_iterator lower_bound(const T& val) const {
+    return bounding<false>(root.get(), val);
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator lower_bound(const K& key) const {
+    return bounding<false>(root.get(), key);
+  }
+
+  // O(log n) strong
+  const_iterator upper_bound(const T& val) const {
+    return bounding<true>(root.get(), val);
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator upper_bound(const K& key) const {
+    return bounding<true>(root.get(), key);
+  }
+
+  // O(log n) strong
+  const_iterator find(const T& val) const {
+    return finding(val);
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator find(const K& key) const {
+    return finding(key);
+  }
+
+  // O(1) nothrow
+  friend void swap(persistent_set& a, persistent_set& b) noexcept {
+    using std::swap;
+    swap(a.comp, b.comp);
+    swap(a.root, b.root);
+  }
+
+private:
+  template <typename, typename>
+  friend class atomic_persistent_set;
+
+  persistent_set(ref root, const Compare& comp) : root(std::move(root)), comp(comp) {}
+
+  static size_t size_of(const node* nd) noexcept {
+    return nd == nullptr ? 0 : nd->size;
+  }
+
+  static size_t weight(const node* nd) noexcept {
+    return size_of(nd) + 1;
+  }
+
+  // the depth is at most MAX_DEPTH, recursion is fine here
+  static void measure(const node* nd, size_t depth, size_t& height, size_t& total_depth) noexcept {
+    if (nd == nullptr) {
+      return;
+    }
+    height = std::max(height, depth);
+    total_depth += depth;
+    measure(nd->left, depth + 1, height, total_depth);
+    measure(nd->right, depth + 1, height, total_depth);
+  }
+
+  static ref share(const node* nd) noexcept {
+    if (nd != nullptr) {
+      nd->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ref(nd);
+  }
+
+  // gives up one reference, frees the nodes that lose their last one
+  static void drop(const node* nd) noexcept {
+    while (nd != nullptr && nd->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      drop(nd->left);
+      const node* right = nd->right;
+      delete nd;
+      nd = right;
+    }
+  }
+
+  // takes over left and right, they are dropped if the value throws
+  template <typename... Args>
+  static ref make(ref left, ref right, Args&&... args) {
+    ref res(new node(left.get(), right.get(), std::forward<Args>(args)...));
+    left.release();
+    right.release();
+    return res;
+  }
+
+  // A node over subtrees that were balanced before one of them gained or
+  // lost one element, at most one single or double rotation is needed.
+  // val must outlive the call, it is copied into the new node.
+  static ref balance(const T& val, ref left, ref right) {
+    if (DELTA * weight(left.get()) < weight(right.get())) {
+      const node* r = right.get();
+      if (weight(r->left) < RATIO * weight(r->right)) {
+        ref a = make(std::move(left), share(r->left), val);
+        return make(std::move(a), share(r->right), r->val);
+      }
+      const node* rl = r->left;
+      ref a = make(std::move(left), share(rl->left), val);
+      ref b = make(share(rl->right), share(r->right), r->val);
+      return make(std::move(a), std::move(b), rl->val);
+    }
+    if (DELTA * weight(right.get()) < weight(left.get())) {
+      const node* l = left.get();
+      if (weight(l->right) < RATIO * weight(l->left)) {
+        ref a = make(share(l->right), std::move(right), val);
+        return make(share(l->left), std::move(a), l->val);
+      }
+      const node* lr = l->right;
+      ref a = make(share(l->left), share(lr->left), l->val);
+      ref b = make(share(lr->right), std::move(right), val);
+      return make(std::move(a), std::move(b), lr->val);
+    }
+    return make(std::move(left), std::move(right), val);
+  }
+
+  // the new root of nd, or an empty ref if key is present
+  template <typename K, typename Leaf>
+  ref adding(const node* nd, const K& key, Leaf& leaf) {
+    if (nd == nullptr) {
+      return leaf();
+    }
+    if (comp(key, nd->val)) {
+      ref left = adding(nd->left, key, leaf);
+      if (left.get() == nullptr) {
+        return left;
+      }
+      return balance(nd->val, std::move(left), share(nd->right));
+    }
+    if (comp(nd->val, key)) {
+      ref right = adding(nd->right, key, leaf);
+      if (right.get() == nullptr) {
+        return right;
+      }
+      return balance(nd->val, share(nd->left), std::move(right));
+    }
+    return ref();
+  }
+
+  template <typename K, typename Leaf>
+  std::pair<iterator, bool> inserting(const K& key, Leaf leaf) {
+    const node* added = nullptr;
+    auto build = [&] {
+      ref res = leaf();
+      added = res.get();
+      return res;
+    };
+    ref new_root = adding(root.get(), key, build);
+    if (new_root.get() == nullptr) {
+      return {bounding<false>(root.get(), key), false};
+    }
+    // the search compares and may throw, so it runs before the commit
+    iterator res = bounding<false>(new_root.get(), added->val);
+    root = std::move(new_root);
+    return {res, true};
+  }
+
+  // the new root of nd without key, erased tells whether it was there
+  template <typename K>
+  ref removing(const node* nd, const K& key, bool& erased) {
+    if (nd == nullptr) {
+      return ref();
+    }
+    if (comp(key, nd->val)) {
+      ref left = removing(nd->left, key, erased);
+      if (!erased) {
+        return ref();
+      }
+      return balance(nd->val, std::move(left), share(nd->right));
+    }
+    if (comp(nd->val, key)) {
+      ref right = removing(nd->right, key, erased);
+      if (!erased) {
+        return ref();
+      }
+      return balance(nd->val, share(nd->left), std::move(right));
+    }
+    erased = true;
+    return glue(nd->left, nd->right);
+  }
+
+  // joins the children of an erased node, taking the new top from the
+  // heavier side keeps it balanced
+  static ref glue(const node* left, const node* right) {
+    if (left == nullptr) {
+      return share(right);
+    }
+    if (right == nullptr) {
+      return share(left);
+    }
+    if (left->size > right->size) {
+      const node* top = left;
+      while (top->right != nullptr) {
+        top = top->right;
+      }
+      ref rest = remove_max(left);
+      return balance(top->val, std::move(rest), share(right));
+    }
+    const node* top = right;
+    while (top->left != nullptr) {
+      top = top->left;
+    }
+    ref rest = remove_min(right);
+    return balance(top->val, share(left), std::move(rest));
+  }
+
+  static ref remove_min(const node* nd) {
+    if (nd->left == nullptr) {
+      return share(nd->right);
+    }
+    ref left = remove_min(nd->left);
+    return balance(nd->val, std::move(left), share(nd->right));
+  }
+
+  static ref remove_max(const node* nd) {
+    if (nd->right == nullptr) {
+      return share(nd->left);
+    }
+    ref right = remove_max(nd->right);
+    return balance(nd->val, share(nd->left), std::move(right));
+  }
+
+  template <typename K>
+  size_t erasing(const K& key) {
+    bool erased = false;
+    ref new_root = removing(root.get(), key, erased);
+    if (!erased) {
+      return 0;
+    }
+    root = std::move(new_root);
+    return 1;
+  }
+
+  // first element not less than key (Upper: greater than key), the path
+  // to it is the prefix of the search path ending at the last left turn
+  template <bool Upper, typename K>
+  const_iterator bounding(const node* from, const K& key) const {
+    const_iterator it(from);
+    size_t found = 0;
+    for (const node* nd = from; nd != nullptr;) {
+      it.path[it.depth++] = nd;
+      if (Upper ? comp(key, nd->val) : !comp(nd->val, key)) {
+        found = it.depth;
+        nd = nd->left;
+      } else {
+        nd = nd->right;
+      }
+    }
+    it.depth = found;
+    return it;
+  }
+
+  template <typename K>
+  const_iterator finding(const K& key) const {
+    const_iterator it = bounding<false>(root.get(), key);
+    if (it.depth == 0 || comp(key, *it)) {
+      return end();
+    }
+    return it;
+  }
+
+  ref root;
+  [[no_unique_address]] Compare comp;
+};
+
+// The latest version of a persistent_set, shared between threads.
+// load() never blocks: it announces itself in the counter of the current
+// epoch, takes a reference to the root and leaves. store() swaps the root,
+// starts a new epoch and waits for the readers of the previous one before
+// dropping the old root, so a reader never touches a freed node.
+// Concurrent stores are serialized.
+template <typename T, typename Compare = std::less<T>>
+class atomic_persistent_set {
+  using version = persistent_set<T, Compare>;
+  using node = typename version::node;
+
+public:
+  atomic_persistent_set() = default;
+
+  // O(1)
+  explicit atomic_persistent_set(version init) : root(init.root.release()), comp(init.comp) {}
+
+  atomic_persistent_set(const atomic_persistent_set&) = delete;
+  atomic_persistent_set& operator=(const atomic_persistent_set&) = delete;
+
+  ~atomic_persistent_set() {
+    version::drop(root.load());
+  }
+
+  // O(1) nothrow, lock-free
+  version load() const noexcept {
+    size_t e = epoch.load();
+    while (true) {
+      readers[e & 1].fetch_add(1);
+      size_t cur = epoch.load();
+      if (cur == e) {
+        break;
+      }
+      readers[e & 1].fetch_sub(1);
+      e = cur;
+    }
+    version res(version::share(root.load()), comp);
+    readers[e & 1].fetch_sub(1);
+    return res;
+  }
+
+  // O(1) plus waiting for the loads in progress and freeing the nodes
+  // only the previous version had
+  void store(version next) {
+    std::lock_guard<std::mutex> lg(writer);
+    const node* old = root.exchange(next.root.release());
+    size_t e = epoch.fetch_add(1);
+    while (readers[e & 1].load() != 0) {
+      std::this_thread::yield();
+    }
+    version::drop(old);
+  }
+
+private:
+  std::atomic<const node*> root{nullptr};
+  mutable std::atomic<size_t> readers[2] = {0, 0};
+  std::atomic<size_t> epoch{0};
+  std::mutex writer;
+  [[no_unique_address]] Compare comp;
+};
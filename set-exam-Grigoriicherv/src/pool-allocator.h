@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Storage for fixed-size blocks, e.g. nodes of a set.
+// Blocks are cut from geometrically growing slabs and recycled through an
+// intrusive free list, release() drops all slabs at once. The block size is
+// fixed by the first allocation. Not thread-safe.
+class node_pool {
+public:
+  node_pool() = default;
+
+  node_pool(const node_pool&) = delete;
+  node_pool& operator=(const node_pool&) = delete;
+
+  ~node_pool() {
+    release();
+  }
+
+  // whether blocks of this pool can hold objects of given size and alignment
+  bool fits(size_t size, size_t align) noexcept {
+    if (block_size == 0) {
+      block_align = std::max(align, alignof(void*));
+      block_size = (std::max(size, sizeof(void*)) + block_align - 1) / block_align * block_align;
+    }
+    return size <= block_size && align <= block_align;
+  }
+
+  void* allocate() {
+    if (reserved > 0) {
+      reserved--;
+      void* res = cur;
+      cur += block_size;
+      return res;
+    }
+    if (free_list != nullptr) {
+      void* res = free_list;
+      free_list = *static_cast<void**>(free_list);
+      return res;
+    }
+    if (cur == end) {
+      add_slab(next_slab_blocks);
+      next_slab_blocks = std::min(next_slab_blocks * 2, MAX_SLAB_BLOCKS);
+    }
+    void* res = cur;
+    cur += block_size;
+    return res;
+  }
+
+  void deallocate(void* ptr) noexcept {
+    *static_cast<void**>(ptr) = free_list;
+    free_list = ptr;
+  }
+
+  // makes the next n allocations take consecutive blocks of one slab,
+  // ahead of the free list, adding a slab if the current one is too short
+  void reserve(size_t n) {
+    if (static_cast<size_t>(end - cur) / block_size < n) {
+      while (cur != end) {
+        deallocate(cur);
+        cur += block_size;
+      }
+      add_slab(n);
+    }
+    reserved = n;
+  }
+
+  // frees every slab, blocks handed out before become dangling
+  void release() noexcept {
+    for (auto [slab, bytes] : slabs) {
+      ::operator delete(slab, bytes, std::align_val_t(block_align));
+    }
+    slabs.clear();
+    free_list = nullptr;
+    cur = end = nullptr;
+    reserved = 0;
+    next_slab_blocks = MIN_SLAB_BLOCKS;
+  }
+
+private:
+  static constexpr size_t MIN_SLAB_BLOCKS = 32;
+  static constexpr size_t MAX_SLAB_BLOCKS = 1 << 16;
+
+  void add_slab(size_t blocks) {
+    slabs.reserve(slabs.size() + 1);
+    size_t bytes = blocks * block_size;
+    cur = static_cast<char*>(::operator new(bytes, std::align_val_t(block_align)));
+    end = cur + bytes;
+    slabs.emplace_back(cur, bytes);
+  }
+
+  size_t block_size = 0;
+  size_t block_align = 0;
+  std::vector<std::pair<void*, size_t>> slabs;
+  void* free_list = nullptr;
+  char* cur = nullptr;
+  char* end = nullptr;
+  // allocations left that reserve() has promised from [cur, end)
+  size_t reserved = 0;
+  size_t next_slab_blocks = MIN_SLAB_BLOCKS;
+};
+
+// Allocator handing out single objects from a shared node_pool, larger
+// requests go to the global heap. Copies share the pool, a container
+// copy gets a fresh one, so that containers can release() their slabs.
+template <typename T>
+class pool_allocator {
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  pool_allocator() : pool(std::make_shared<node_pool>()) {}
+
+  // no move constructor: a moved-from allocator must still own its pool
+  pool_allocator(const pool_allocator&) noexcept = default;
+  pool_allocator& operator=(const pool_allocator&) noexcept = default;
+
+  template <typename U>
+  pool_allocator(const pool_allocator<U>& other) noexcept : pool(other.pool) {}
+
+  T* allocate(size_t n) {
+    if (n == 1 && pool->fits(sizeof(T), alignof(T))) {
+      return static_cast<T*>(pool->allocate());
+    }
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* ptr, size_t n) noexcept {
+    if (n == 1 && pool->fits(sizeof(T), alignof(T))) {
+      pool->deallocate(ptr);
+    } else {
+      std::allocator<T>().deallocate(ptr, n);
+    }
+  }
+
+  pool_allocator select_on_container_copy_construction() const {
+    return pool_allocator();
+  }
+
+  // next n single-object allocations are served from one slab
+  void reserve(size_t n) {
+    if (pool->fits(sizeof(T), alignof(T))) {
+      pool->reserve(n);
+    }
+  }
+
+  // frees all slabs at once if no other allocator shares the pool,
+  // returns whether it did
+  bool release() noexcept {
+    if (pool.use_count() != 1) {
+      return false;
+    }
+    pool->release();
+    return true;
+  }
+
+  friend bool operator==(const pool_allocator& a, const pool_allocator& b) noexcept {
+    return a.pool == b.pool;
+  }
+
+private:
+  template <typename U>
+  friend class pool_allocator;
+
+  std::shared_ptr<node_pool> pool;
+};
@@ -1,19 +1,56 @@
 #pragma once
 
+#include "frozen-set.h"
+#include "mapped-file.h"
+#include "parallel.h"
+#include "sorted-unique.h"
+#include "tree-shape.h"
+
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <concepts>
+#include <filesystem>
+#include <functional>
 #include <iterator>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <thread>
+#include <type_traits>
 #include <utility>
-
-template <typename T>
+#include <vector>
+
+// OrderStatistics keeps subtree sizes in the nodes for nth(), rank() and
+// count_range(), Threaded links the nodes into an in-order list, so that
+// ++, -- and begin() follow one pointer. Without them nodes have no extra
+// fields.
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>,
+          bool OrderStatistics = false, bool Threaded = false>
 class set {
   struct node;
+  struct no_size {};
+  struct basenode;
+  struct links {
+    basenode* pred;
+    basenode* succ;
+  };
+  struct no_links {};
   struct basenode {
     basenode* right;
     basenode* left;
     basenode* parent;
+    // red-black colour, the fake node and the root are always black
+    bool red;
+    // number of nodes in the subtree, garbage in the fake node
+    [[no_unique_address]] std::conditional_t<OrderStatistics, size_t, no_size> subtree_size;
+    // in-order neighbours: nullptr before the minimum, the fake node after
+    // the maximum; the fake node holds the maximum and the minimum, or
+    // nullptr and garbage in an empty set
+    [[no_unique_address]] std::conditional_t<Threaded, links, no_links> order;
 
     basenode() = default;
-    basenode(basenode* left, basenode* right, basenode* parent) : left(left), right(right), parent(parent){}
+    basenode(basenode* left, basenode* right, basenode* parent) : right(right), left(left), parent(parent), red(true){}
     ~basenode() = default;
   };
 
@@ -21,13 +58,15 @@ class set {
     T val;
 
     node() = delete;
-    node(T const& val, basenode* l = nullptr, basenode* r = nullptr, basenode* p = nullptr) : val(val), basenode(l,r,p){}
+    node(T const& val, basenode* l = nullptr, basenode* r = nullptr, basenode* p = nullptr) : basenode(l,r,p), val(val){}
+    template <typename... Args>
+    explicit node(std::in_place_t, Args&&... args) : basenode(nullptr, nullptr, nullptr), val(std::forward<Args>(args)...){}
     ~node() = default;
   };
 
   template<typename R>
   struct my_iterator : std::iterator<std::bidirectional_iterator_tag, R> {
-    friend struct set<T>;
+    friend class set;
 
     my_iterator() = default;
 
@@ -107,45 +146,234 @@ public:
   using reverse_iterator = std::reverse_iterator<iterator>;
   using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
+  using allocator_type = Allocator;
+  using key_compare = Compare;
+  using value_compare = Compare;
+
   mutable basenode fake;
   size_t size_set;
+  // the maximum, nullptr in an empty set, makes hints at the end O(1)
+  basenode* rightmost;
+
+private:
+  using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<node>;
+  using node_traits = std::allocator_traits<node_allocator>;
+
+  [[no_unique_address]] node_allocator alloc;
+  [[no_unique_address]] Compare comp;
+
+  // whether lookups accept any key comparable with T, like std::less<>
+  static constexpr bool transparent = requires { typename Compare::is_transparent; };
+
+  template <typename... Args>
+  node* create_node(Args&&... args) {
+    node* res = node_traits::allocate(alloc, 1);
+    try {
+      node_traits::construct(alloc, res, std::forward<Args>(args)...);
+    } catch (...) {
+      node_traits::deallocate(alloc, res, 1);
+      throw;
+    }
+    return res;
+  }
 
+  void destroy_node(basenode* nd) noexcept {
+    node_traits::destroy(alloc, static_cast<node*>(nd));
+    node_traits::deallocate(alloc, static_cast<node*>(nd), 1);
+  }
 
+  // allocators able to free all their memory at once, like pool_allocator
+  static constexpr bool releasable = requires(node_allocator& a) {
+    { a.release() } -> std::same_as<bool>;
+  };
 
-public:
+  // allocators able to serve the next n nodes from one block
+  static constexpr bool reservable = requires(node_allocator& a, size_t n) {
+    a.reserve(n);
+  };
 
+public:
+  // O(1) nothrow for nothrow constructible allocators
+  set() noexcept(std::is_nothrow_default_constructible_v<node_allocator>) : fake(), size_set(0), rightmost(nullptr) {}
 
+  // O(1)
+  explicit set(const Compare& comp, const Allocator& alloc = Allocator())
+      : fake(), size_set(0), rightmost(nullptr), alloc(alloc), comp(comp) {}
 
-  // O(1) nothrow
-  set() : fake(), size_set(0) {}
+  // O(1)
+  explicit set(const Allocator& alloc) : set(Compare(), alloc) {}
 
   // O(n) strong
-  set(const set& other) : set(){
+  set(const set& other) : set(other.comp, node_traits::select_on_container_copy_construction(other.alloc)){
+    copy(other);
     size_set = other.size_set;
-    if (other.fake.left != nullptr) {
-      fake.left = new node(static_cast<node*>(other.fake.left)->val, nullptr, nullptr, &fake);
+    rightmost = fake.left == nullptr ? nullptr : find_max(fake.left);
+    if constexpr (Threaded) {
+      thread_tree();
+    }
+  }
+
+  // O(1) nothrow
+  set(set&& other) noexcept : fake(), size_set(0), rightmost(nullptr), alloc(std::move(other.alloc)), comp(other.comp) {
+    take_tree(other);
+  }
+
+  // O(n) strong, [first, last) must be strictly increasing
+  template <std::input_iterator It>
+  set(sorted_unique_t, It first, It last, const Compare& comp = Compare(), const Allocator& alloc = Allocator())
+      : set(comp, alloc) {
+    if constexpr (reservable && std::forward_iterator<It>) {
+      this->alloc.reserve(static_cast<size_t>(std::distance(first, last)));
+    }
+    basenode* head = nullptr;
+    basenode** tail = &head;
+    size_t count = 0;
+    try {
+      for (; first != last; ++first) {
+        *tail = create_node(*first);
+        tail = &(*tail)->right;
+        count++;
+      }
+    } catch (...) {
+      destroy_list(head);
+      throw;
+    }
+    assign_list(head, count);
+  }
 
-      if (other.fake.left->right != nullptr) {
-        fake.left->right = new node(0, nullptr, nullptr, fake.left);
-        copy(static_cast<node*>(fake.left->right), static_cast<node*>(other.fake.left->right));
+  // O(n log n / threads + n) strong, the set of values of [first, last)
+  // given in any order. The values are copied into a vector, which takes
+  // O(n) memory besides the nodes until the end, sorted and deduplicated
+  // there, and the tree is built by up to `threads` threads, all cores
+  // when 0. Nodes are allocated in parallel only for allocators declared
+  // thread-safe, see thread_safe_allocator, otherwise on this thread.
+  template <std::input_iterator It>
+  static set build_parallel(It first, It last, size_t threads = 0, const Compare& comp = Compare(),
+                            const Allocator& alloc = Allocator()) {
+    set res(comp, alloc);
+    std::vector<T> vals(first, last);
+    threads = workers(threads, vals.size());
+    res.sort_parallel(vals, threads);
+    std::vector<basenode*> nodes = res.create_unique(vals, thread_safe_allocator<node_allocator> ? threads : 1);
+    try {
+      res.assign_nodes(nodes, threads);
+    } catch (...) {
+      for (basenode* nd : nodes) {
+        res.destroy_node(nd);
       }
-      if (other.fake.left->left != nullptr) {
-        fake.left->left = new node(0, nullptr, nullptr, fake.left);
-        copy(static_cast<node*>(fake.left->left), static_cast<node*>(other.fake.left->left));
+      throw;
+    }
+    return res;
+  }
+
+  allocator_type get_allocator() const {
+    return allocator_type(alloc);
+  }
+
+  key_compare key_comp() const {
+    return comp;
+  }
+
+  value_compare value_comp() const {
+    return comp;
+  }
+
+  // O(n) strong, an immutable copy laid out for fast lookups
+  frozen_set<T, Compare> freeze() const {
+    return frozen_set<T, Compare>(sorted_unique, begin(), end(), size_set, comp);
+  }
+
+  // O(n) strong, writes the keys in increasing order to a flat file that
+  // load() of set or frozen_set reads back, see save_keys()
+  void save(const std::filesystem::path& path) const requires std::is_trivially_copyable_v<T> {
+    save_keys<T>(path, begin(), end(), size_set);
+  }
+
+  // O(n) strong, the set saved to path by save(). The file is mapped into
+  // memory and its keys, already in order, are linked into a balanced tree
+  // without any search.
+  static set load(const std::filesystem::path& path, const Compare& comp = Compare(),
+                  const Allocator& alloc = Allocator()) requires std::is_trivially_copyable_v<T> {
+    mapped_keys<T> keys(path);
+    keys.check_increasing(comp);
+    return set(sorted_unique, keys.begin(), keys.end(), comp, alloc);
+  }
+
+  // O(n) nothrow, height and mean depth of the tree and the memory of its
+  // nodes, to watch the balance of long-lived sets. Comparisons per
+  // operation are counted by a counting_compare comparator.
+  tree_shape shape() const noexcept {
+    tree_shape res{size_set, 0, 0, size_set * sizeof(node)};
+    basenode* nd = fake.left;
+    if (nd == nullptr) {
+      return res;
+    }
+    size_t depth = 1;
+    size_t total_depth = 0;
+    while (nd->left != nullptr) {
+      nd = nd->left;
+      depth++;
+    }
+    // in-order walk by parent links, which keeps track of the depth
+    while (nd != &fake) {
+      total_depth += depth;
+      res.height = std::max(res.height, depth);
+      if (nd->right != nullptr) {
+        nd = nd->right;
+        depth++;
+        while (nd->left != nullptr) {
+          nd = nd->left;
+          depth++;
+        }
+      } else {
+        while (nd->parent->right == nd) {
+          nd = nd->parent;
+          depth--;
+        }
+        nd = nd->parent;
+        depth--;
       }
     }
+    res.average_depth = static_cast<double>(total_depth) / static_cast<double>(size_set);
+    return res;
   }
-  void copy(node* in, node* out){
-    in->val = out->val;
-    if (out->left != nullptr){
-      in->left = new node(0, nullptr, nullptr, in);
-      copy(static_cast<node*>(in->left), static_cast<node*>(out->left));
+
+  // Clones the shape of other's tree walking it in preorder by parent links,
+  // `in` always mirrors `out`. Every new node is linked in at once, so if a
+  // copy throws the destructor frees what has been built.
+  void copy(const set& other){
+    basenode* out = other.fake.left;
+    if (out == nullptr){
+      return;
+    }
+    if constexpr (reservable) {
+      alloc.reserve(other.size_set);
     }
-    if (out->right != nullptr){
-      in->right = new node(0, nullptr, nullptr, in);
-      copy(static_cast<node*>(in->right), static_cast<node*>(out->right));
+    fake.left = clone(out, &fake);
+    basenode* in = fake.left;
+    while (true){
+      if (out->left != nullptr && in->left == nullptr){
+        out = out->left;
+        in->left = clone(out, in);
+        in = in->left;
+      } else if (out->right != nullptr && in->right == nullptr){
+        out = out->right;
+        in->right = clone(out, in);
+        in = in->right;
+      } else if (out != other.fake.left){
+        out = out->parent;
+        in = in->parent;
+      } else {
+        break;
+      }
     }
   }
+  node* clone(basenode* out, basenode* parent){
+    node* res = create_node(static_cast<node*>(out)->val, nullptr, nullptr, parent);
+    res->red = out->red;
+    res->subtree_size = out->subtree_size;
+    return res;
+  }
 
   // O(n) strong
   set& operator=(const set& other){
@@ -154,25 +382,338 @@ public:
     return *this;
   }
 
+  // O(n) nothrow if the allocator propagates or is always equal,
+  // otherwise elements are moved one by one in O(n) basic
+  set& operator=(set&& other) noexcept(node_traits::propagate_on_container_move_assignment::value ||
+                                       node_traits::is_always_equal::value){
+    if (this == &other){
+      return *this;
+    }
+    comp = other.comp;
+    if constexpr (node_traits::propagate_on_container_move_assignment::value){
+      clear();
+      alloc = std::move(other.alloc);
+      take_tree(other);
+    } else {
+      clear();
+      if (alloc == other.alloc){
+        take_tree(other);
+      } else {
+        for (basenode* nd = other.fake.left == nullptr ? &other.fake : find_min(other.fake.left); nd != &other.fake; nd = next(nd)){
+          emplace_hint(end(), std::move(static_cast<node*>(nd)->val));
+        }
+        other.clear();
+      }
+    }
+    return *this;
+  }
+
+  // moves the tree of other, which must be empty, to this set
+  void take_tree(set& other) noexcept{
+    assert(fake.left == nullptr);
+    fake.left = other.fake.left;
+    if (fake.left != nullptr){
+      fake.left->parent = &fake;
+    }
+    size_set = other.size_set;
+    rightmost = other.rightmost;
+    fake.order = other.fake.order;
+    if constexpr (Threaded) {
+      if (rightmost != nullptr){
+        rightmost->order.succ = &fake;
+      }
+    }
+    other.fake.left = nullptr;
+    other.size_set = 0;
+    other.rightmost = nullptr;
+    other.fake.order = {};
+  }
+
 
   // O(n) nothrow
   ~set() noexcept{
     clear();
   }
 
-  //  O(n) nothrow
+  //  O(n) nothrow, O(number of slabs) for trivially destructible T
+  //  and an allocator owning its memory alone
   void clear() noexcept{
     size_set = 0;
+    if constexpr (releasable && std::is_trivially_destructible_v<T>) {
+      if (alloc.release()) {
+        fake.left = nullptr;
+        rightmost = nullptr;
+        fake.order = {};
+        return;
+      }
+    }
     clearing(fake.left);
     fake.left = nullptr;
+    rightmost = nullptr;
+    fake.order = {};
   }
-  void clearing(basenode* nd){
+  // deletes the subtree of nd descending to a leaf and climbing back by
+  // parent links, O(1) extra space, returns the number of nodes deleted
+  size_t clearing(basenode* nd) noexcept{
+    size_t res = 0;
     if (nd == nullptr){
+      return res;
+    }
+    basenode* stop = nd->parent;
+    while (nd != stop){
+      if (nd->left != nullptr){
+        nd = nd->left;
+      } else if (nd->right != nullptr){
+        nd = nd->right;
+      } else {
+        basenode* par = nd->parent;
+        if (par->left == nd){
+          par->left = nullptr;
+        } else {
+          par->right = nullptr;
+        }
+        destroy_node(nd);
+        res++;
+        nd = par;
+      }
+    }
+    return res;
+  }
+
+  // Sorted lists of nodes are chained through `right`.
+
+  void destroy_list(basenode* head) noexcept{
+    while (head != nullptr){
+      basenode* nxt = head->right;
+      destroy_node(head);
+      head = nxt;
+    }
+  }
+
+  static size_t list_length(basenode* head) noexcept{
+    size_t res = 0;
+    for (; head != nullptr; head = head->right){
+      res++;
+    }
+    return res;
+  }
+
+  // unlinks all nodes into a sorted list, leaving the set empty, O(n).
+  // next() climbs by parent links looking at left children only, or
+  // follows the thread, so the right link of a visited node is free to be
+  // reused.
+  basenode* to_list() noexcept{
+    if (fake.left == nullptr){
+      return nullptr;
+    }
+    basenode* head = find_min(fake.left);
+    basenode* cur = head;
+    while (true){
+      basenode* nxt = next(cur);
+      if (nxt == &fake){
+        break;
+      }
+      cur->right = nxt;
+      cur = nxt;
+    }
+    cur->right = nullptr;
+    fake.left = nullptr;
+    size_set = 0;
+    rightmost = nullptr;
+    fake.order = {};
+    return head;
+  }
+
+  // makes an empty set hold a sorted list of n nodes as a perfectly balanced
+  // tree, O(n) nothrow
+  void assign_list(basenode* head, size_t n) noexcept{
+    assert(fake.left == nullptr);
+    if (n == 0){
       return;
     }
-    clearing(nd->right);
-    clearing(nd->left);
-    delete static_cast<node*>(nd);
+    if constexpr (Threaded) {
+      thread_list(head);
+    }
+    fake.left = build_balanced(head, n, 0, std::bit_width(n) - 1);
+    fake.left->parent = &fake;
+    fake.left->red = false;
+    size_set = n;
+    rightmost = find_max(fake.left);
+  }
+
+  // Takes n nodes from the list, halves put in the subtrees. Sizes of sibling
+  // subtrees differ by at most one, so every level but the deepest is full
+  // and painting that level red makes a valid red-black tree.
+  static basenode* build_balanced(basenode*& head, size_t n, size_t depth, size_t red_depth) noexcept{
+    if (n == 0){
+      return nullptr;
+    }
+    size_t left_size = (n - 1) / 2;
+    basenode* left = build_balanced(head, left_size, depth + 1, red_depth);
+    basenode* nd = head;
+    head = head->right;
+    nd->left = left;
+    if (left != nullptr){
+      left->parent = nd;
+    }
+    nd->right = build_balanced(head, n - 1 - left_size, depth + 1, red_depth);
+    if (nd->right != nullptr){
+      nd->right->parent = nd;
+    }
+    nd->red = depth == red_depth;
+    if constexpr (OrderStatistics){
+      nd->subtree_size = n;
+    }
+    return nd;
+  }
+
+  // Parallel building. Ranges are cut into one slice per thread at
+  // positions i * n / threads.
+
+  static constexpr size_t MIN_PER_THREAD = 1 << 14;
+
+  // threads worth starting for n elements, all cores when threads is 0
+  static size_t workers(size_t threads, size_t n) noexcept{
+    if (threads == 0){
+      threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    return std::clamp<size_t>(n / MIN_PER_THREAD, 1, threads);
+  }
+
+  // sorts the slices in parallel, then merges neighbours pairwise in
+  // log(threads) parallel rounds
+  void sort_parallel(std::vector<T>& vals, size_t threads) const{
+    size_t n = vals.size();
+    auto slice = [&](size_t i){
+      return vals.begin() + static_cast<std::ptrdiff_t>(n * std::min(i, threads) / threads);
+    };
+    parallel_for(threads, [&](size_t i){
+      std::sort(slice(i), slice(i + 1), comp);
+    });
+    for (size_t width = 1; width < threads; width *= 2){
+      parallel_for((threads + 2 * width - 1) / (2 * width), [&](size_t i){
+        std::inplace_merge(slice(2 * width * i), slice(2 * width * i + width), slice(2 * width * (i + 1)), comp);
+      });
+    }
+  }
+
+  // nodes of the distinct values of sorted vals, which are moved from;
+  // the first pass marks and counts the values to keep per slice, the
+  // second one builds each slice's nodes at its offset
+  std::vector<basenode*> create_unique(std::vector<T>& vals, size_t threads){
+    size_t n = vals.size();
+    std::vector<char> keep(n);
+    std::vector<size_t> offsets(threads + 1);
+    parallel_for(threads, [&](size_t t){
+      size_t kept = 0;
+      for (size_t i = n * t / threads; i < n * (t + 1) / threads; ++i){
+        keep[i] = i == 0 || comp(vals[i - 1], vals[i]);
+        kept += keep[i];
+      }
+      offsets[t + 1] = kept;
+    });
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<basenode*> nodes(offsets[threads], nullptr);
+    try {
+      parallel_for(threads, [&](size_t t){
+        size_t out = offsets[t];
+        for (size_t i = n * t / threads; i < n * (t + 1) / threads; ++i){
+          if (keep[i]){
+            nodes[out++] = create_node(std::in_place, std::move(vals[i]));
+          }
+        }
+      });
+    } catch (...) {
+      for (basenode* nd : nodes){
+        if (nd != nullptr){
+          destroy_node(nd);
+        }
+      }
+      throw;
+    }
+    return nodes;
+  }
+
+  // makes an empty set hold sorted distinct nodes as a perfectly balanced
+  // tree, changes nothing if starting a thread throws
+  void assign_nodes(const std::vector<basenode*>& nodes, size_t threads){
+    assert(fake.left == nullptr);
+    size_t n = nodes.size();
+    if (n == 0){
+      return;
+    }
+    basenode* root = build_balanced(nodes.data(), n, 0, std::bit_width(n) - 1, threads);
+    if constexpr (Threaded){
+      parallel_for(threads, [&](size_t t){
+        for (size_t i = n * t / threads; i < n * (t + 1) / threads; ++i){
+          nodes[i]->order = {i == 0 ? nullptr : nodes[i - 1], i + 1 == n ? &fake : nodes[i + 1]};
+        }
+      });
+      fake.order = {nodes.back(), nodes.front()};
+    }
+    fake.left = root;
+    root->parent = &fake;
+    root->red = false;
+    size_set = n;
+    rightmost = nodes.back();
+  }
+
+  // the same shape as the list version, the two subtrees of a node are
+  // built by different threads while there are threads to spare
+  static basenode* build_balanced(basenode* const* nodes, size_t n, size_t depth, size_t red_depth, size_t threads){
+    if (n == 0){
+      return nullptr;
+    }
+    size_t left_size = (n - 1) / 2;
+    basenode* nd = nodes[left_size];
+    basenode* children[2];
+    auto build = [&](size_t i){
+      children[i] = i == 0 ? build_balanced(nodes, left_size, depth + 1, red_depth, threads / 2)
+                           : build_balanced(nodes + left_size + 1, n - 1 - left_size, depth + 1, red_depth,
+                                            threads - threads / 2);
+    };
+    if (threads > 1){
+      parallel_for(2, build);
+    } else {
+      build(0);
+      build(1);
+    }
+    nd->left = children[0];
+    nd->right = children[1];
+    for (basenode* child : children){
+      if (child != nullptr){
+        child->parent = nd;
+      }
+    }
+    nd->red = depth == red_depth;
+    if constexpr (OrderStatistics){
+      nd->subtree_size = n;
+    }
+    return nd;
+  }
+
+  // about count keys splitting the set evenly, picked from the top levels
+  std::vector<const T*> splitters(size_t count) const{
+    std::vector<const T*> top;
+    collect_top(fake.left, std::bit_width(count), top);
+    std::vector<const T*> res;
+    for (size_t i = 1; i <= count; ++i){
+      size_t j = (top.size() + 1) * i / (count + 1);
+      if (j > 0 && (res.empty() || res.back() != top[j - 1])){
+        res.push_back(top[j - 1]);
+      }
+    }
+    return res;
+  }
+
+  // values of the nodes less than `levels` deep, in order
+  static void collect_top(basenode* nd, size_t levels, std::vector<const T*>& out){
+    if (nd == nullptr || levels == 0){
+      return;
+    }
+    collect_top(nd->left, levels - 1, out);
+    out.push_back(&static_cast<node*>(nd)->val);
+    collect_top(nd->right, levels - 1, out);
   }
 
   // O(1) nothrow
@@ -185,9 +726,12 @@ public:
     return size_set == 0;
   }
 
-  // nothrow
+  // O(log n) nothrow, O(1) when Threaded
   const_iterator begin() const noexcept{
     if (fake.left != nullptr) {
+      if constexpr (Threaded) {
+        return const_iterator(fake.order.succ);
+      }
       return const_iterator(find_min(fake.left));
     }else{
       return const_iterator(&fake);
@@ -209,36 +753,416 @@ public:
     return const_reverse_iterator(begin());
   }
 
-  // O(h) strong
+  // O(log n) strong
   std::pair<iterator, bool> insert(T const& el) {
+    position pos = descend(el);
+    if (pos.slot == nullptr) {
+      return {iterator(pos.parent), false};
+    }
+    return {link(pos, create_node(el)), true};
+  }
+
+  // O(log n) strong, el is left untouched if not inserted
+  std::pair<iterator, bool> insert(T&& el) {
+    position pos = descend(el);
+    if (pos.slot == nullptr) {
+      return {iterator(pos.parent), false};
+    }
+    return {link(pos, create_node(std::in_place, std::move(el))), true};
+  }
+
+  // amortized O(1) if el goes right before or right after hint,
+  // O(log n) otherwise, strong
+  iterator insert(const_iterator hint, T const& el) {
+    position pos = hinted(hint.ptr, el);
+    if (pos.slot == nullptr) {
+      return iterator(pos.parent);
+    }
+    return link(pos, create_node(el));
+  }
+
+  // same as above, el is left untouched if not inserted
+  iterator insert(const_iterator hint, T&& el) {
+    position pos = hinted(hint.ptr, el);
+    if (pos.slot == nullptr) {
+      return iterator(pos.parent);
+    }
+    return link(pos, create_node(std::in_place, std::move(el)));
+  }
+
+  // O(log n) strong, the value is built before the search
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    node* nd = create_node(std::in_place, std::forward<Args>(args)...);
+    position pos;
+    try {
+      pos = descend(nd->val);
+    } catch (...) {
+      destroy_node(nd);
+      throw;
+    }
+    if (pos.slot == nullptr) {
+      destroy_node(nd);
+      return {iterator(pos.parent), false};
+    }
+    return {link(pos, nd), true};
+  }
+
+  // same as insert(hint, T(args...)), strong
+  template <typename... Args>
+  iterator emplace_hint(const_iterator hint, Args&&... args) {
+    node* nd = create_node(std::in_place, std::forward<Args>(args)...);
+    position pos;
+    try {
+      pos = hinted(hint.ptr, nd->val);
+    } catch (...) {
+      destroy_node(nd);
+      throw;
+    }
+    if (pos.slot == nullptr) {
+      destroy_node(nd);
+      return iterator(pos.parent);
+    }
+    return link(pos, nd);
+  }
+
+  // Where a value goes: the empty child slot of parent to link it into,
+  // or slot == nullptr and parent holding an equal value.
+  struct position {
+    basenode* parent;
+    basenode** slot;
+  };
+
+  position descend(const T& el) const {
     basenode** cur = &(fake.left);
-    basenode* prev = &fake;
+    basenode* par = &fake;
     while (*cur != nullptr) {
-      prev = *cur;
-      if (el < (static_cast<node*>(*cur))->val) {
+      par = *cur;
+      if (comp(el, static_cast<node*>(*cur)->val)) {
         cur = &((*cur)->left);
-      } else if (static_cast<node*>(*cur)->val < el) {
+      } else if (comp(static_cast<node*>(*cur)->val, el)) {
         cur = &((*cur)->right);
       } else {
-        return {iterator(*cur), false};
+        return {*cur, nullptr};
+      }
+    }
+    return {par, cur};
+  }
+
+  // Checks el against the hint and its neighbour on the proper side,
+  // at most two comparisons when the hint is right. Of two neighbours
+  // one always has an empty child slot facing the other.
+  position hinted(basenode* hint, const T& el) const {
+    if (hint == &fake) {
+      if (rightmost == nullptr) {
+        return {&fake, &fake.left};
       }
+      if (comp(static_cast<node*>(rightmost)->val, el)) {
+        return {rightmost, &rightmost->right};
+      }
+      return descend(el);
     }
-    node* new_node = new node(el, nullptr, nullptr, prev);
-    *cur = new_node;
+    const T& val = static_cast<node*>(hint)->val;
+    if (comp(el, val)) {
+      basenode* before = prev(hint);
+      if (before == nullptr || comp(static_cast<node*>(before)->val, el)) {
+        if (hint->left == nullptr) {
+          return {hint, &hint->left};
+        }
+        return {before, &before->right};
+      }
+      return descend(el);
+    }
+    if (comp(val, el)) {
+      if (hint == rightmost) {
+        return {hint, &hint->right};
+      }
+      basenode* after = next(hint);
+      if (comp(el, static_cast<node*>(after)->val)) {
+        if (hint->right == nullptr) {
+          return {hint, &hint->right};
+        }
+        return {after, &after->left};
+      }
+      return descend(el);
+    }
+    return {hint, nullptr};
+  }
+
+  iterator link(position pos, basenode* nd) noexcept {
+    nd->parent = pos.parent;
+    nd->red = true;
+    *pos.slot = nd;
+    if constexpr (OrderStatistics) {
+      nd->subtree_size = 1;
+      for (basenode* p = nd->parent; p != &fake; p = p->parent) {
+        p->subtree_size++;
+      }
+    }
+    if constexpr (Threaded) {
+      if (pos.slot == &pos.parent->left) {
+        weave(nd, pos.parent->order.pred, pos.parent);
+      } else {
+        weave(nd, pos.parent, pos.parent->order.succ);
+      }
+    }
+    if (rightmost == nullptr || pos.slot == &rightmost->right) {
+      rightmost = nd;
+    }
+    insert_fixup(nd);
     size_set++;
-    return {iterator(new_node), true};
+    return iterator(nd);
   }
 
-  // O(h) nothrow
-  iterator erase(const_iterator pos){
-    iterator it = erasing(pos);
-    if (it.ptr != nullptr){
-      size_set--;
+  // O(n + m) basic, O(m log(n + m)) for short forward ranges,
+  // [first, last) must be sorted. Rebuilds the tree from the merge of
+  // the old nodes and the new ones, iterators stay valid.
+  template <std::input_iterator It>
+  void insert_sorted(It first, It last) {
+    if constexpr (std::forward_iterator<It>) {
+      size_t m = static_cast<size_t>(std::distance(first, last));
+      if (m * std::bit_width(size_set) < size_set) {
+        for (; first != last; ++first) {
+          insert(*first);
+        }
+        return;
+      }
+      if constexpr (reservable) {
+        alloc.reserve(m);
+      }
+    }
+    basenode* old = to_list();
+    basenode* head = nullptr;
+    basenode** tail = &head;
+    basenode* last_node = nullptr;
+    size_t count = 0;
+    try {
+      for (; first != last; ++first) {
+        while (old != nullptr && comp(static_cast<node*>(old)->val, *first)) {
+          last_node = *tail = old;
+          tail = &old->right;
+          old = old->right;
+          count++;
+        }
+        if (old != nullptr && !comp(*first, static_cast<node*>(old)->val)) {
+          continue;
+        }
+        if (last_node != nullptr && !comp(static_cast<node*>(last_node)->val, *first)) {
+          continue;
+        }
+        last_node = *tail = create_node(*first);
+        tail = &last_node->right;
+        count++;
+      }
+    } catch (...) {
+      *tail = old;
+      assign_list(head, count + list_length(old));
+      throw;
+    }
+    *tail = old;
+    assign_list(head, count + list_length(old));
+  }
+
+  // Moves the nodes of other whose values are missing here into this set,
+  // without copying or reallocating, equal values stay in other. Iterators
+  // stay valid, the moved ones point into this set. O(n + m) basic, both
+  // trees are rebuilt from the merge of their sorted lists; O(m log(n + m))
+  // when other is much smaller. Allocators must be equal.
+  void merge(set& other){
+    if (this == &other){
+      return;
+    }
+    assert(alloc == other.alloc);
+    if (other.size_set * std::bit_width(size_set + other.size_set) < size_set){
+      basenode* nd = other.begin().ptr;
+      while (nd != &other.fake){
+        basenode* nxt = next(nd);
+        position pos = descend(static_cast<node*>(nd)->val);
+        if (pos.slot != nullptr){
+          other.unlink(nd);
+          link(pos, nd);
+        }
+        nd = nxt;
+      }
+      return;
+    }
+    basenode* mine = to_list();
+    basenode* theirs = other.to_list();
+    basenode* head = nullptr;
+    basenode** tail = &head;
+    basenode* kept = nullptr;
+    basenode** kept_tail = &kept;
+    try {
+      while (mine != nullptr && theirs != nullptr){
+        if (comp(static_cast<node*>(theirs)->val, static_cast<node*>(mine)->val)){
+          *tail = theirs;
+          theirs = theirs->right;
+        } else {
+          if (!comp(static_cast<node*>(mine)->val, static_cast<node*>(theirs)->val)){
+            *kept_tail = theirs;
+            kept_tail = &theirs->right;
+            theirs = theirs->right;
+          }
+          *tail = mine;
+          mine = mine->right;
+        }
+        tail = &(*tail)->right;
+      }
+    } catch (...) {
+      // the merged prefix is less than both rests, the kept nodes equal
+      // some of it
+      *tail = mine;
+      *kept_tail = theirs;
+      assign_list(head, list_length(head));
+      other.assign_list(kept, list_length(kept));
+      throw;
+    }
+    *tail = mine != nullptr ? mine : theirs;
+    *kept_tail = nullptr;
+    assign_list(head, list_length(head));
+    other.assign_list(kept, list_length(kept));
+  }
+
+  // same as above
+  void merge(set&& other){
+    merge(other);
+  }
+
+  // O(n + m) strong, the elements present in a or b
+  friend set set_union(const set& a, const set& b){
+    return combine<true, true, true>(a, b);
+  }
+
+  // O(n + m) strong, the elements present in both a and b
+  friend set set_intersection(const set& a, const set& b){
+    return combine<false, false, true>(a, b);
+  }
+
+  // O(n + m) strong, the elements of a missing in b
+  friend set set_difference(const set& a, const set& b){
+    return combine<true, false, false>(a, b);
+  }
+
+  // O((n + m) / threads + threads log(n + m)) strong, set_union computed
+  // by up to `threads` threads, all cores when 0; each one handles a key
+  // range. Serial for allocators not declared thread-safe, see
+  // thread_safe_allocator.
+  friend set set_union(const set& a, const set& b, size_t threads){
+    return combine_parallel<true, true, true>(a, b, threads);
+  }
+
+  // same as above, for set_intersection
+  friend set set_intersection(const set& a, const set& b, size_t threads){
+    return combine_parallel<false, false, true>(a, b, threads);
+  }
+
+  // Copies the values the operation keeps into a sorted list, which
+  // becomes the balanced tree of the result.
+  template <bool OnlyA, bool OnlyB, bool Both>
+  static set combine(const set& a, const set& b){
+    set res(a.comp, node_traits::select_on_container_copy_construction(a.alloc));
+    basenode* head = nullptr;
+    basenode** tail = &head;
+    size_t count = 0;
+    try {
+      combining<OnlyA, OnlyB, Both>(a.begin(), a.end(), b.begin(), b.end(), a.comp, [&](const T& val){
+        *tail = res.create_node(val);
+        tail = &(*tail)->right;
+        count++;
+      });
+    } catch (...) {
+      *tail = nullptr;
+      res.destroy_list(head);
+      throw;
+    }
+    *tail = nullptr;
+    res.assign_list(head, count);
+    return res;
+  }
+
+  // Cuts the key space at splitters of the larger set; every range is
+  // combined by its own thread into its own nodes, which are then built
+  // into one tree in parallel.
+  template <bool OnlyA, bool OnlyB, bool Both>
+  static set combine_parallel(const set& a, const set& b, size_t threads){
+    threads = workers(threads, a.size_set + b.size_set);
+    if (threads == 1 || !thread_safe_allocator<node_allocator>){
+      return combine<OnlyA, OnlyB, Both>(a, b);
+    }
+    set res(a.comp, node_traits::select_on_container_copy_construction(a.alloc));
+    std::vector<const T*> cuts = (a.size_set >= b.size_set ? a : b).splitters(threads - 1);
+    std::vector<std::vector<basenode*>> pieces(cuts.size() + 1);
+    try {
+      parallel_for(pieces.size(), [&](size_t i){
+        const_iterator x = i == 0 ? a.begin() : a.lower_bound(*cuts[i - 1]);
+        const_iterator x_end = i == cuts.size() ? a.end() : a.lower_bound(*cuts[i]);
+        const_iterator y = i == 0 ? b.begin() : b.lower_bound(*cuts[i - 1]);
+        const_iterator y_end = i == cuts.size() ? b.end() : b.lower_bound(*cuts[i]);
+        combining<OnlyA, OnlyB, Both>(x, x_end, y, y_end, a.comp, [&](const T& val){
+          pieces[i].push_back(nullptr);
+          pieces[i].back() = res.create_node(val);
+        });
+      });
+      std::vector<basenode*> nodes;
+      for (const std::vector<basenode*>& piece : pieces){
+        nodes.insert(nodes.end(), piece.begin(), piece.end());
+      }
+      res.assign_nodes(nodes, threads);
+    } catch (...) {
+      for (const std::vector<basenode*>& piece : pieces){
+        for (basenode* nd : piece){
+          if (nd != nullptr){
+            res.destroy_node(nd);
+          }
+        }
+      }
+      throw;
+    }
+    return res;
+  }
+
+  // Walks two sorted ranges in lock-step passing the values the operation
+  // keeps to emit. Values present in both are taken from the first range.
+  template <bool OnlyA, bool OnlyB, bool Both, typename Emit>
+  static void combining(const_iterator x, const_iterator x_end, const_iterator y, const_iterator y_end,
+                        const Compare& comp, Emit emit){
+    while (x != x_end && y != y_end){
+      if (comp(*x, *y)){
+        if constexpr (OnlyA){
+          emit(*x);
+        }
+        ++x;
+      } else if (comp(*y, *x)){
+        if constexpr (OnlyB){
+          emit(*y);
+        }
+        ++y;
+      } else {
+        if constexpr (Both){
+          emit(*x);
+        }
+        ++x;
+        ++y;
+      }
+    }
+    if constexpr (OnlyA){
+      for (; x != x_end; ++x){
+        emit(*x);
+      }
+    }
+    if constexpr (OnlyB){
+      for (; y != y_end; ++y){
+        emit(*y);
+      }
     }
-    return it;
   }
 
-  // O(h) strong
+  // O(log n) nothrow
+  iterator erase(const_iterator pos){
+    return erasing(pos);
+  }
+
+  // O(log n) strong
   size_t erase(const T& val){
     const_iterator it = find(val);
     if (it == end()){
@@ -250,167 +1174,830 @@ public:
     }
   }
 
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent && (!std::is_convertible_v<const K&, const_iterator>)
+  size_t erase(const K& key){
+    const_iterator it = find(key);
+    if (it == end()){
+      return 0;
+    }
+    erase(it);
+    return 1;
+  }
+
+  // O(log n + k) nothrow: the tree is split around first and last, the
+  // k nodes between are freed without rebalancing and the two outer parts
+  // are joined through last. Iterators to the rest stay valid.
+  iterator erase(const_iterator first, const_iterator last) noexcept{
+    if (first == last){
+      return iterator(last.ptr);
+    }
+    if (first == begin() && last == end()){
+      clear();
+      return end();
+    }
+    basenode* lo = first.ptr;
+    basenode* hi = last.ptr;
+    basenode* before = prev(lo);
+    if constexpr (Threaded) {
+      hi->order.pred = before;
+      (before == nullptr ? fake.order.succ : before->order.succ) = hi;
+    }
+    if (hi == &fake){
+      rightmost = before;
+    }
+    basenode* less;
+    size_t less_height;
+    basenode* rest;
+    size_t rest_height;
+    split_around(lo, &fake, less, less_height, rest, rest_height);
+    fake.left = nullptr;
+    destroy_node(lo);
+    size_t k = 1;
+    if (hi == &fake){
+      k += destroy_subtree(rest);
+      rest = less;
+    } else {
+      basenode top{};
+      top.left = rest;
+      rest->parent = &top;
+      basenode* middle;
+      size_t middle_height;
+      basenode* greater;
+      size_t greater_height;
+      split_around(hi, &top, middle, middle_height, greater, greater_height);
+      k += destroy_subtree(middle);
+      rest = join(less, less_height, hi, greater, greater_height, rest_height);
+    }
+    if (rest != nullptr){
+      fake.left = rest;
+      rest->parent = &fake;
+    }
+    size_set -= k;
+    return iterator(hi);
+  }
+
+  // O(log n + k) strong, erases the elements of [lo, hi) and returns how
+  // many there were
+  size_t erase_range(const T& lo, const T& hi){
+    if (!comp(lo, hi)){
+      return 0;
+    }
+    const_iterator first = lower_bound(lo);
+    const_iterator last = lower_bound(hi);
+    size_t n = size_set;
+    erase(first, last);
+    return n - size_set;
+  }
+
+  // O(log n) strong with OrderStatistics, O(log n + k) otherwise,
+  // number of elements in [lo, hi)
+  size_t count(const T& lo, const T& hi) const{
+    if (!comp(lo, hi)){
+      return 0;
+    }
+    if constexpr (OrderStatistics){
+      return count_range(lo, hi);
+    }
+    const_iterator last = lower_bound(hi);
+    size_t res = 0;
+    for (const_iterator it = lower_bound(lo); it != last; ++it){
+      res++;
+    }
+    return res;
+  }
+
   iterator erasing(const_iterator pos){
-    iterator res(pos.ptr);
-    ++res;
-    if (pos.ptr->right == nullptr && pos.ptr->left == nullptr){
-      basenode* it = pos.ptr;
-      it = find_parent_max(it);
-      if (it != nullptr) {
-        if (pos.ptr->parent->right == pos.ptr) {
-          pos.ptr->parent->right = nullptr;
-        } else {
-          pos.ptr->parent->left = nullptr;
-        }
-      }
-      else{
-        fake.left = nullptr;
-      }
-      delete static_cast<node*>(pos.ptr);
+    iterator res(next(pos.ptr));
+    unlink(pos.ptr);
+    destroy_node(pos.ptr);
+    return res;
+  }
+
+  void unlink(basenode* nd) noexcept{
+    if (nd == rightmost){
+      rightmost = prev(nd);
     }
-    else if (pos.ptr->right == nullptr || pos.ptr->left == nullptr){
-      basenode* child;
-      if (pos.ptr->right == nullptr){
-        child = pos.ptr->left;
-      }
-      else{
-        child = pos.ptr->right;
+    if constexpr (Threaded) {
+      unweave(nd);
+    }
+    erase_node(nd);
+    size_set--;
+  }
+
+  // Threaded list upkeep. The slot a node is linked into decides its
+  // neighbours: a left child goes right before its parent, a right child
+  // right after it.
+
+  void weave(basenode* nd, basenode* pred, basenode* succ) noexcept requires Threaded{
+    nd->order = {pred, succ};
+    succ->order.pred = nd;
+    (pred == nullptr ? fake.order.succ : pred->order.succ) = nd;
+  }
+
+  void unweave(basenode* nd) noexcept requires Threaded{
+    basenode* pred = nd->order.pred;
+    basenode* succ = nd->order.succ;
+    succ->order.pred = pred;
+    (pred == nullptr ? fake.order.succ : pred->order.succ) = succ;
+  }
+
+  // threads a non-empty list chained through `right`
+  void thread_list(basenode* head) noexcept requires Threaded{
+    basenode* pred = nullptr;
+    for (basenode* nd = head; nd != nullptr; nd = nd->right){
+      weave(nd, pred, &fake);
+      pred = nd;
+    }
+  }
+
+  // threads the whole tree walking it by parent links
+  void thread_tree() noexcept requires Threaded{
+    if (fake.left == nullptr){
+      return;
+    }
+    basenode* pred = nullptr;
+    for (basenode* nd = find_min(fake.left); nd != &fake; nd = climb_next(nd)){
+      weave(nd, pred, &fake);
+      pred = nd;
+    }
+  }
+
+  // Owns a node taken out of a set, so that its value can be changed or
+  // the node can be moved into another set with an equal allocator
+  // without copying the value or reallocating.
+  class node_type {
+  public:
+    using value_type = T;
+    using allocator_type = Allocator;
+
+    node_type() noexcept = default;
+
+    node_type(node_type&& other) noexcept : nd(std::exchange(other.nd, nullptr)), alloc(std::move(other.alloc)) {
+      other.alloc.reset();
+    }
+
+    node_type& operator=(node_type&& other) noexcept {
+      if (this != &other) {
+        reset();
+        nd = std::exchange(other.nd, nullptr);
+        alloc = std::move(other.alloc);
+        other.alloc.reset();
       }
-      change_leafs(pos.ptr, child);
-      delete static_cast<node*>(pos.ptr);
+      return *this;
     }
-    else{
-      basenode* tmp = pos.ptr->right;
-      tmp = find_min(tmp);
-      change_leafs(tmp, tmp->right);
-      swap_links(tmp, pos.ptr);
-      if (tmp->parent == nullptr){
-        fake.left = tmp;
+
+    ~node_type() {
+      reset();
+    }
+
+    bool empty() const noexcept {
+      return nd == nullptr;
+    }
+
+    explicit operator bool() const noexcept {
+      return nd != nullptr;
+    }
+
+    T& value() const {
+      assert(nd != nullptr);
+      return nd->val;
+    }
+
+    allocator_type get_allocator() const {
+      assert(nd != nullptr);
+      return allocator_type(*alloc);
+    }
+
+  private:
+    friend class set;
+
+    node_type(node* nd, const node_allocator& alloc) noexcept : nd(nd), alloc(alloc) {}
+
+    node* release() noexcept {
+      alloc.reset();
+      return std::exchange(nd, nullptr);
+    }
+
+    void reset() noexcept {
+      if (nd != nullptr) {
+        node_traits::destroy(*alloc, nd);
+        node_traits::deallocate(*alloc, nd, 1);
+        nd = nullptr;
       }
-      delete static_cast<node*>(pos.ptr);
+      alloc.reset();
     }
-    return res;
+
+    node* nd = nullptr;
+    std::optional<node_allocator> alloc;
+  };
+
+  struct insert_return_type {
+    iterator position;
+    bool inserted;
+    node_type node;
+  };
+
+  // O(log n) nothrow, pos must be dereferenceable
+  node_type extract(const_iterator pos) noexcept{
+    unlink(pos.ptr);
+    return node_type(static_cast<node*>(pos.ptr), alloc);
+  }
+
+  // O(log n) strong
+  node_type extract(const T& val){
+    const_iterator it = find(val);
+    if (it == end()){
+      return node_type();
+    }
+    return extract(it);
+  }
+
+  // O(log n) strong, the handle keeps the node if an equal value is present
+  insert_return_type insert(node_type&& nh){
+    if (nh.empty()){
+      return {end(), false, node_type()};
+    }
+    assert(*nh.alloc == alloc);
+    position pos = descend(nh.nd->val);
+    if (pos.slot == nullptr){
+      return {iterator(pos.parent), false, std::move(nh)};
+    }
+    return {link(pos, nh.release()), true, node_type()};
+  }
+
+  // amortized O(1) with a right hint, O(log n) otherwise, strong
+  iterator insert(const_iterator hint, node_type&& nh){
+    if (nh.empty()){
+      return end();
+    }
+    assert(*nh.alloc == alloc);
+    position pos = hinted(hint.ptr, nh.nd->val);
+    if (pos.slot == nullptr){
+      return iterator(pos.parent);
+    }
+    return link(pos, nh.release());
+  }
+
+  // Red-black rebalancing. The root hangs off fake.left, so the fake node
+  // is an ordinary parent for rotations and relinking, and the loops below
+  // stop at the root by its parent being &fake.
+
+  static void rotate_left(basenode* x) noexcept {
+    basenode* y = x->right;
+    if constexpr (OrderStatistics) {
+      y->subtree_size = x->subtree_size;
+      x->subtree_size -= 1 + subtree_size_of(y->right);
+    }
+    x->right = y->left;
+    if (y->left != nullptr) {
+      y->left->parent = x;
+    }
+    y->parent = x->parent;
+    if (x->parent->left == x) {
+      x->parent->left = y;
+    } else {
+      x->parent->right = y;
+    }
+    y->left = x;
+    x->parent = y;
   }
-  void change_leafs(basenode* from, basenode* to) {
-    if (from->parent == nullptr) {
-      fake.left = to;
+
+  static void rotate_right(basenode* x) noexcept {
+    basenode* y = x->left;
+    if constexpr (OrderStatistics) {
+      y->subtree_size = x->subtree_size;
+      x->subtree_size -= 1 + subtree_size_of(y->left);
+    }
+    x->left = y->right;
+    if (y->right != nullptr) {
+      y->right->parent = x;
+    }
+    y->parent = x->parent;
+    if (x->parent->left == x) {
+      x->parent->left = y;
     } else {
-      if (from->parent->right == from) {
-        from->parent->right = to;
-        if (to != nullptr) {
-          to->parent = from->parent;
+      x->parent->right = y;
+    }
+    y->right = x;
+    x->parent = y;
+  }
+
+  static size_t subtree_size_of(basenode* nd) noexcept requires OrderStatistics {
+    return nd == nullptr ? 0 : nd->subtree_size;
+  }
+
+  static bool is_red(basenode* nd) noexcept {
+    return nd != nullptr && nd->red;
+  }
+
+  void insert_fixup(basenode* nd) noexcept {
+    fix_red_parent(nd, &fake);
+    fake.left->red = false;
+  }
+
+  // restores the red rule above the red node nd in the tree hanging off
+  // top->left, leaving its root possibly red
+  static void fix_red_parent(basenode* nd, basenode* top) noexcept {
+    while (nd->parent != top && nd->parent->red) {
+      basenode* par = nd->parent;
+      basenode* grand = par->parent;
+      if (par == grand->left) {
+        basenode* uncle = grand->right;
+        if (is_red(uncle)) {
+          par->red = false;
+          uncle->red = false;
+          grand->red = true;
+          nd = grand;
+          continue;
+        }
+        if (nd == par->right) {
+          rotate_left(par);
+          std::swap(nd, par);
         }
+        par->red = false;
+        grand->red = true;
+        rotate_right(grand);
       } else {
-        from->parent->left = to;
-        if (to != nullptr) {
-          to->parent = from->parent;
+        basenode* uncle = grand->left;
+        if (is_red(uncle)) {
+          par->red = false;
+          uncle->red = false;
+          grand->red = true;
+          nd = grand;
+          continue;
         }
+        if (nd == par->left) {
+          rotate_right(par);
+          std::swap(nd, par);
+        }
+        par->red = false;
+        grand->red = true;
+        rotate_left(grand);
       }
     }
+  }
+
+  // Split and join of detached red-black trees, which have black roots
+  // and no parent. A tree is passed with its black height: the number of
+  // black nodes on a path from its root down to a leaf, 0 when empty.
+
+  static size_t black_height(basenode* nd) noexcept {
+    size_t res = 0;
+    for (; nd != nullptr; nd = nd->left) {
+      res += !nd->red;
+    }
+    return res;
+  }
 
+  // detaches a subtree of black height height, painting its root black
+  static void detach(basenode* nd, size_t& height) noexcept {
+    if (nd == nullptr) {
+      return;
+    }
+    nd->parent = nullptr;
+    if (nd->red) {
+      nd->red = false;
+      height++;
+    }
+  }
+
+  static void attach(basenode* nd, basenode* left, basenode* right) noexcept {
+    nd->left = left;
+    nd->right = right;
+    if (left != nullptr) {
+      left->parent = nd;
+    }
+    if (right != nullptr) {
+      right->parent = nd;
+    }
+    if constexpr (OrderStatistics) {
+      nd->subtree_size = subtree_size_of(left) + subtree_size_of(right) + 1;
+    }
+  }
 
-    from->right = nullptr;
-    from->parent = nullptr;
-    from->left = nullptr;
+  // the tree of l < m < r, O(|lh - rh| + 1). m hangs below the taller tree
+  // at a black node of the other tree's height and the red rule is
+  // restored upwards as after an insertion.
+  static basenode* join(basenode* l, size_t lh, basenode* m, basenode* r, size_t rh, size_t& height) noexcept {
+    if (lh == rh) {
+      attach(m, l, r);
+      m->red = false;
+      m->parent = nullptr;
+      height = lh + 1;
+      return m;
+    }
+    bool left_taller = lh > rh;
+    basenode* tall = left_taller ? l : r;
+    basenode* low = left_taller ? r : l;
+    size_t target = left_taller ? rh : lh;
+    height = left_taller ? lh : rh;
+    basenode top{};
+    top.left = tall;
+    tall->parent = &top;
+    basenode* par = &top;
+    basenode* cur = tall;
+    for (size_t h = height; h > target || is_red(cur);) {
+      h -= !cur->red;
+      if constexpr (OrderStatistics) {
+        cur->subtree_size += subtree_size_of(low) + 1;
+      }
+      par = cur;
+      cur = left_taller ? cur->right : cur->left;
+    }
+    if (left_taller) {
+      attach(m, cur, r);
+      par->right = m;
+    } else {
+      attach(m, l, cur);
+      par->left = m;
+    }
+    m->parent = par;
+    m->red = true;
+    fix_red_parent(m, &top);
+    basenode* root = top.left;
+    if (root->red) {
+      root->red = false;
+      height++;
+    }
+    root->parent = nullptr;
+    return root;
   }
-  void swap_links(basenode* first, basenode* second){
-    basenode* tmp = first->left;
-    first->left = second->left;
-    second->left = tmp;
-    if (first->left != nullptr) {
-      first->left->parent = first;
+
+  // splits the tree hanging off top->left into the trees l of the nodes
+  // before x and r of the nodes after it, leaving x unlinked. Climbing from
+  // x, each ancestor is joined with its other subtree to the side it falls
+  // on; the heights telescope, so the whole split is O(log n).
+  static void split_around(basenode* x, basenode* top, basenode*& l, size_t& lh, basenode*& r,
+                           size_t& rh) noexcept {
+    size_t height = black_height(x) - !x->red;
+    l = x->left;
+    lh = height;
+    r = x->right;
+    rh = height;
+    detach(l, lh);
+    detach(r, rh);
+    height += !x->red;
+    basenode* from = x;
+    basenode* par = x->parent;
+    while (par != top) {
+      basenode* up = par->parent;
+      bool from_left = par->left == from;
+      basenode* other = from_left ? par->right : par->left;
+      size_t other_height = height;
+      height += !par->red;
+      detach(other, other_height);
+      if (from_left) {
+        r = join(r, rh, par, other, other_height, rh);
+      } else {
+        l = join(other, other_height, par, l, lh, lh);
+      }
+      from = par;
+      par = up;
     }
-    if (second->left != nullptr) {
-      second->left->parent = second;
+    x->left = x->right = x->parent = nullptr;
+  }
+
+  // deletes a detached tree, returns the number of its nodes
+  size_t destroy_subtree(basenode* nd) noexcept {
+    if (nd == nullptr) {
+      return 0;
     }
-    tmp = first->right;
-    first->right = second->right;
-    second->right = tmp;
-    if (first->right != nullptr){
-      first->right->parent = first;
+    basenode top{};
+    top.left = nd;
+    nd->parent = &top;
+    return clearing(nd);
+  }
+
+  // puts `to` (possibly nullptr) in place of `from` under from's parent
+  static void transplant(basenode* from, basenode* to) noexcept {
+    if (from->parent->left == from) {
+      from->parent->left = to;
+    } else {
+      from->parent->right = to;
     }
-    if (second->right != nullptr) {
-      second->right->parent = second;
+    if (to != nullptr) {
+      to->parent = from->parent;
     }
-    tmp = first->parent;
-    first->parent = second->parent;
-    second->parent = tmp;
-    if (first->parent != nullptr) {
-      if (first->parent->right == second){
-        first->parent->right = first;
+  }
+
+  // unlinks nd from the tree, nodes are relinked, never values swapped,
+  // so iterators to other elements stay valid
+  void erase_node(basenode* nd) noexcept {
+    if constexpr (OrderStatistics) {
+      basenode* gone = nd->left != nullptr && nd->right != nullptr ? find_min(nd->right) : nd;
+      for (basenode* p = gone->parent; p != &fake; p = p->parent) {
+        p->subtree_size--;
       }
-      else{
-        first->parent->left = first;
+    }
+    basenode* removed = nd;
+    bool removed_red = nd->red;
+    basenode* child;
+    basenode* child_parent;
+    if (nd->left == nullptr) {
+      child = nd->right;
+      child_parent = nd->parent;
+      transplant(nd, nd->right);
+    } else if (nd->right == nullptr) {
+      child = nd->left;
+      child_parent = nd->parent;
+      transplant(nd, nd->left);
+    } else {
+      removed = find_min(nd->right);
+      removed_red = removed->red;
+      child = removed->right;
+      if (removed->parent == nd) {
+        child_parent = removed;
+      } else {
+        child_parent = removed->parent;
+        transplant(removed, removed->right);
+        removed->right = nd->right;
+        removed->right->parent = removed;
       }
+      transplant(nd, removed);
+      removed->left = nd->left;
+      removed->left->parent = removed;
+      removed->red = nd->red;
+      removed->subtree_size = nd->subtree_size;
     }
-    if (second->parent != nullptr) {
-      if (second->parent->right == first) {
-        second->parent->right = first;
+    nd->left = nd->right = nd->parent = nullptr;
+    if (!removed_red) {
+      erase_fixup(child, child_parent);
+    }
+  }
+
+  void erase_fixup(basenode* nd, basenode* par) noexcept {
+    while (nd != fake.left && !is_red(nd)) {
+      if (nd == par->left) {
+        basenode* sibling = par->right;
+        if (sibling->red) {
+          sibling->red = false;
+          par->red = true;
+          rotate_left(par);
+          sibling = par->right;
+        }
+        if (!is_red(sibling->left) && !is_red(sibling->right)) {
+          sibling->red = true;
+          nd = par;
+          par = nd->parent;
+          continue;
+        }
+        if (!is_red(sibling->right)) {
+          sibling->left->red = false;
+          sibling->red = true;
+          rotate_right(sibling);
+          sibling = par->right;
+        }
+        sibling->red = par->red;
+        par->red = false;
+        sibling->right->red = false;
+        rotate_left(par);
       } else {
-        second->parent->left = first;
+        basenode* sibling = par->left;
+        if (sibling->red) {
+          sibling->red = false;
+          par->red = true;
+          rotate_right(par);
+          sibling = par->left;
+        }
+        if (!is_red(sibling->left) && !is_red(sibling->right)) {
+          sibling->red = true;
+          nd = par;
+          par = nd->parent;
+          continue;
+        }
+        if (!is_red(sibling->left)) {
+          sibling->right->red = false;
+          sibling->red = true;
+          rotate_left(sibling);
+          sibling = par->left;
+        }
+        sibling->red = par->red;
+        par->red = false;
+        sibling->left->red = false;
+        rotate_right(par);
       }
+      nd = fake.left;
+    }
+    if (nd != nullptr) {
+      nd->red = false;
     }
   }
 
-  // O(h) strong
+  // O(log n) strong
   const_iterator lower_bound(const T& val) const{
     return l_bounding(val, fake.left, &fake);
   }
-  const_iterator l_bounding(const T& val, basenode* nd, basenode* res) const{
-    if (nd == nullptr){
-      return const_iterator(res);
-    }
-    else if (static_cast<node*>(nd)->val >= val){
-      res = nd;
-      return l_bounding(val, nd->left, res);
-    }
-    if (static_cast<node*>(nd)->val < val){
-      return l_bounding(val, nd->right, res);
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator lower_bound(const K& key) const{
+    return l_bounding(key, fake.left, &fake);
+  }
+
+  template <typename K>
+  const_iterator l_bounding(const K& val, basenode* nd, basenode* res) const{
+    while (nd != nullptr){
+      if (comp(static_cast<node*>(nd)->val, val)){
+        nd = nd->right;
+      } else {
+        res = nd;
+        nd = nd->left;
+      }
     }
+    return const_iterator(res);
   }
 
 
-  // O(h) strong
+  // O(log n) strong
   const_iterator upper_bound(const T& val) const{
     return u_bounding(val, fake.left, &fake);
   }
 
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  const_iterator upper_bound(const K& key) const{
+    return u_bounding(key, fake.left, &fake);
+  }
 
-  const_iterator u_bounding(const T& val, basenode* nd, basenode* res) const{
-    if (nd == nullptr){
-      return const_iterator(res);
-    }
-    else if (static_cast<node*>(nd)->val > val){
-      res = nd;
-      return u_bounding(val, nd->left, res);
-    }
-    if (static_cast<node*>(nd)->val <= val){
-      return u_bounding(val, nd->right, res);
+  template <typename K>
+  const_iterator u_bounding(const K& val, basenode* nd, basenode* res) const{
+    while (nd != nullptr){
+      if (comp(val, static_cast<node*>(nd)->val)){
+        res = nd;
+        nd = nd->left;
+      } else {
+        nd = nd->right;
+      }
     }
+    return const_iterator(res);
   }
 
-  // O(h) strong
-  iterator find(const T& val){
+  // O(log n) strong
+  iterator find(const T& val) const{
     return finding(val, fake.left);
   }
-  iterator finding(const T& val, basenode* nd){
-    if (nd == nullptr){
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires transparent
+  iterator find(const K& key) const{
+    return finding(key, fake.left);
+  }
+
+  // lower bound descent with a single comparison per level,
+  // equality is checked once at the end
+  template <typename K>
+  iterator finding(const K& val, basenode* nd) const{
+    basenode* res = &fake;
+    while (nd != nullptr){
+      if (comp(static_cast<node*>(nd)->val, val)){
+        nd = nd->right;
+      } else {
+        res = nd;
+        nd = nd->left;
+      }
+    }
+    if (res == &fake || comp(val, static_cast<node*>(res)->val)){
       return iterator(&fake);
     }
-    if (val < static_cast<node*>(nd)->val){
-      return finding(val, nd->left);
+    return iterator(res);
+  }
+
+  // O(m log n) strong, writes find(key) for every key of [first, last)
+  // to out, keys are searched in groups advancing level by level
+  template <std::forward_iterator It, typename Out>
+  requires transparent || std::convertible_to<std::iter_reference_t<It>, const T&>
+  Out find_batch(It first, It last, Out out) const{
+    batching(first, last, [&](basenode* res){
+      *out++ = const_iterator(res);
+    });
+    return out;
+  }
+
+  // O(m log n) strong, writes whether each key of [first, last) is present
+  template <std::forward_iterator It, typename Out>
+  requires transparent || std::convertible_to<std::iter_reference_t<It>, const T&>
+  Out contains_batch(It first, It last, Out out) const{
+    batching(first, last, [&](basenode* res){
+      *out++ = res != &fake;
+    });
+    return out;
+  }
+
+  // Runs the descents of finding() for BATCH keys in lock-step. After one
+  // search steps to a child it prefetches it and moves on to the others,
+  // so the cache misses of the group overlap instead of stalling one by
+  // one.
+  template <typename It, typename Emit>
+  void batching(It first, It last, Emit emit) const{
+    static constexpr size_t BATCH = 16;
+    It keys[BATCH];
+    basenode* cur[BATCH];
+    basenode* res[BATCH];
+    while (first != last){
+      size_t n = 0;
+      for (; n < BATCH && first != last; ++n, ++first){
+        keys[n] = first;
+        cur[n] = fake.left;
+        res[n] = &fake;
+      }
+      for (size_t active = fake.left == nullptr ? 0 : n; active > 0;){
+        for (size_t i = 0; i < n; ++i){
+          basenode* nd = cur[i];
+          if (nd == nullptr){
+            continue;
+          }
+          if (comp(static_cast<node*>(nd)->val, *keys[i])){
+            nd = nd->right;
+          } else {
+            res[i] = nd;
+            nd = nd->left;
+          }
+          cur[i] = nd;
+          if (nd == nullptr){
+            active--;
+          } else {
+            prefetch(nd);
+          }
+        }
+      }
+      for (size_t i = 0; i < n; ++i){
+        if (res[i] != &fake && comp(*keys[i], static_cast<node*>(res[i])->val)){
+          res[i] = &fake;
+        }
+        emit(res[i]);
+      }
     }
-    else if (val > static_cast<node*>(nd)->val){
-      return finding(val, nd->right);
+  }
+
+  static void prefetch([[maybe_unused]] const basenode* nd) noexcept{
+#if defined(__GNUC__)
+    __builtin_prefetch(nd);
+#endif
+  }
+
+  // O(log n) nothrow, the k-th smallest element counting from zero
+  // or end() if k >= size()
+  const_iterator nth(size_t k) const noexcept requires OrderStatistics{
+    basenode* nd = fake.left;
+    while (nd != nullptr){
+      size_t left = subtree_size_of(nd->left);
+      if (k < left){
+        nd = nd->left;
+      } else if (k == left){
+        return const_iterator(nd);
+      } else {
+        k -= left + 1;
+        nd = nd->right;
+      }
     }
-    else{
-      return iterator(nd);
+    return end();
+  }
+
+  // O(log n) strong, number of elements less than val,
+  // that is the index of lower_bound(val)
+  size_t rank(const T& val) const requires OrderStatistics{
+    return ranking(val);
+  }
+
+  // O(log n) strong, for transparent comparators
+  template <typename K>
+  requires OrderStatistics && transparent
+  size_t rank(const K& key) const{
+    return ranking(key);
+  }
+
+  // O(log n) strong, number of elements in [lo, hi)
+  size_t count_range(const T& lo, const T& hi) const requires OrderStatistics{
+    return comp(lo, hi) ? ranking(hi) - ranking(lo) : 0;
+  }
+
+  template <typename K>
+  size_t ranking(const K& val) const{
+    size_t res = 0;
+    basenode* nd = fake.left;
+    while (nd != nullptr){
+      if (comp(static_cast<node*>(nd)->val, val)){
+        res += subtree_size_of(nd->left) + 1;
+        nd = nd->right;
+      } else {
+        nd = nd->left;
+      }
     }
+    return res;
   }
 
   // O(1) nothrow
   friend void swap(set& a, set& b) noexcept{
+    using std::swap;
+    swap(a.alloc, b.alloc);
+    swap(a.comp, b.comp);
     std::swap(a.size_set, b.size_set);
+    std::swap(a.rightmost, b.rightmost);
     if (a.fake.left != nullptr) {
       a.fake.left->parent = &b.fake;
     }
@@ -418,16 +2005,47 @@ public:
       b.fake.left->parent = &a.fake;
     }
     std::swap(a.fake.left, b.fake.left);
+    std::swap(a.fake.order, b.fake.order);
+    if constexpr (Threaded) {
+      if (a.rightmost != nullptr) {
+        a.rightmost->order.succ = &a.fake;
+      }
+      if (b.rightmost != nullptr) {
+        b.rightmost->order.succ = &b.fake;
+      }
+    }
   }
   friend basenode* find_min(basenode* cur) noexcept {
-    return (cur->left == nullptr) ? cur : find_min(cur->left);
+    while (cur->left != nullptr) {
+      cur = cur->left;
+    }
+    return cur;
   }
 
   friend basenode* find_max(basenode* cur) noexcept {
-    return (cur->right == nullptr) ? cur : find_max(cur->right);
+    while (cur->right != nullptr) {
+      cur = cur->right;
+    }
+    return cur;
   }
 
+  // the next node, the fake one after the maximum
   static basenode* next(basenode* cur) noexcept {
+    if constexpr (Threaded) {
+      return cur->order.succ;
+    }
+    return climb_next(cur);
+  }
+
+  // the previous node, nullptr before the minimum
+  static basenode* prev(basenode* cur) noexcept {
+    if constexpr (Threaded) {
+      return cur->order.pred;
+    }
+    return climb_prev(cur);
+  }
+
+  static basenode* climb_next(basenode* cur) noexcept {
     if (cur->right != nullptr) {
       return find_min(cur->right);
     }
@@ -437,7 +2055,7 @@ public:
     return cur->parent;
   }
 
-  static basenode* prev(basenode* cur) noexcept {
+  static basenode* climb_prev(basenode* cur) noexcept {
     if (cur->left != nullptr) {
       return find_max(cur->left);
     }
@@ -446,28 +2064,4 @@ public:
     }
     return cur->parent;
   }
-  friend basenode* find_parent_max(basenode* nd){
-    if (nd->parent == nullptr){
-      return nullptr;
-    }
-    while(nd->parent->left != nd){
-      nd = nd->parent;
-      if (nd->parent == nullptr){
-        return nullptr;
-      }
-    }
-    return nd->parent;
-  }
-  friend basenode* find_parent_min(basenode* nd){
-    if (nd->parent == nullptr){
-      return nullptr;
-    }
-    while(nd->parent->right != nd){
-      nd = nd->parent;
-      if (nd->parent == nullptr){
-        return nullptr;
-      }
-    }
-    return nd->parent;
-  }
 };
\ No newline at end of file
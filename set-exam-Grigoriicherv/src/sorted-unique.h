@@ -0,0 +1,7 @@
+#pragma once
+
+// tag of constructors taking a strictly increasing range
+struct sorted_unique_t {
+  explicit sorted_unique_t() = default;
+};
+inline constexpr sorted_unique_t sorted_unique{};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// Shape of a search tree, as reported by shape() of set.
+struct tree_shape {
+  size_t size;
+  // nodes on the longest path from the root, 0 in an empty tree
+  size_t height;
+  // mean number of nodes on the path from the root to a node
+  double average_depth;
+  // bytes taken by the nodes, not counting the allocator's own headers
+  size_t node_bytes;
+};
+
+// Comparator counting how many times it has been called, to measure
+// comparisons per operation:
+//   set<int, counting_compare<>> c;
+//   ...
+//   c.key_comp().reset();
+//   c.find(42);
+//   c.key_comp().count();
+// Copies share the counter, so the one in a set is reached through
+// key_comp(), and so do copies of the set. Counting is atomic, so the
+// parallel operations may use it.
+template <typename Compare = std::less<>>
+class counting_compare {
+public:
+  using is_transparent = void;
+
+  counting_compare() : counting_compare(Compare()) {}
+
+  explicit counting_compare(const Compare& comp) : comp(comp), counter(std::make_shared<std::atomic<uint64_t>>(0)) {}
+
+  template <typename A, typename B>
+  bool operator()(const A& a, const B& b) const {
+    counter->fetch_add(1, std::memory_order_relaxed);
+    return comp(a, b);
+  }
+
+  // comparisons made since construction or the last reset()
+  uint64_t count() const noexcept {
+    return counter->load(std::memory_order_relaxed);
+  }
+
+  void reset() const noexcept {
+    counter->store(0, std::memory_order_relaxed);
+  }
+
+private:
+  [[no_unique_address]] Compare comp;
+  std::shared_ptr<std::atomic<uint64_t>> counter;
+};
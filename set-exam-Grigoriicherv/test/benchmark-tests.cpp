@@ -0,0 +1,170 @@
+#include "set.h"
+#include "test-utils.h"
+#include "tree-shape.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Runs each workload on set and on std::set and prints both timings with
+// the shape of the resulting tree and the comparisons per operation, also
+// recorded as test properties so that runs can be compared. The tests fail
+// on diverging results or an unbalanced tree, never on time.
+class benchmark_performance_test : public base_test {
+protected:
+  static constexpr size_t N = 500'000;
+
+  using counted_set = set<int, counting_compare<>>;
+
+  // prepare(c) fills the container untimed, run(c) is timed and returns a
+  // checksum of what it found, ops is the number of operations it makes
+  template <typename Prepare, typename Run>
+  void compare(const std::string& name, size_t ops, Prepare prepare, Run run) {
+    std::set<int> reference;
+    prepare(reference);
+    uint64_t expected = 0;
+    double std_ms = time_ms([&] { expected = run(reference); });
+
+    set<int> c;
+    prepare(c);
+    uint64_t actual = 0;
+    double set_ms = time_ms([&] { actual = run(c); });
+    EXPECT_EQ(expected, actual);
+    expect_eq(c, reference);
+
+    counted_set counted;
+    prepare(counted);
+    counted.key_comp().reset();
+    run(counted);
+    double comparisons = static_cast<double>(counted.key_comp().count()) / static_cast<double>(ops);
+
+    tree_shape shape = c.shape();
+    EXPECT_LE(shape.height, 2 * std::bit_width(shape.size + 1));
+
+    std::printf("%-16s set %8.1f ms   std::set %8.1f ms   height %3zu   average depth %6.2f   "
+                "comparisons/op %6.2f   node bytes/element %5.1f\n",
+                name.c_str(), set_ms, std_ms, shape.height, shape.average_depth, comparisons,
+                shape.size == 0 ? 0.0 : static_cast<double>(shape.node_bytes) / static_cast<double>(shape.size));
+    RecordProperty(name + "_set_ms", static_cast<int>(set_ms));
+    RecordProperty(name + "_std_set_ms", static_cast<int>(std_ms));
+    RecordProperty(name + "_height", static_cast<int>(shape.height));
+  }
+
+  template <typename F>
+  static double time_ms(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  static std::vector<int> random_keys(size_t n, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<int> keys(n);
+    for (int& k : keys) {
+      k = static_cast<int>(rng() % (4 * N));
+    }
+    return keys;
+  }
+
+  static constexpr auto nothing = [](auto&) {};
+};
+
+} // namespace
+
+TEST_F(benchmark_performance_test, random_insert) {
+  std::vector<int> keys = random_keys(N, 1);
+  compare("random_insert", N, nothing, [&](auto& c) {
+    uint64_t inserted = 0;
+    for (int k : keys) {
+      inserted += c.insert(k).second;
+    }
+    return inserted;
+  });
+}
+
+TEST_F(benchmark_performance_test, sorted_insert) {
+  compare("sorted_insert", N, nothing, [](auto& c) {
+    for (size_t i = 0; i < N; ++i) {
+      c.insert(static_cast<int>(i));
+    }
+    return static_cast<uint64_t>(c.size());
+  });
+}
+
+TEST_F(benchmark_performance_test, reverse_insert) {
+  compare("reverse_insert", N, nothing, [](auto& c) {
+    for (size_t i = N; i > 0; --i) {
+      c.insert(static_cast<int>(i));
+    }
+    return static_cast<uint64_t>(c.size());
+  });
+}
+
+TEST_F(benchmark_performance_test, zipfian_lookup) {
+  constexpr size_t LOOKUPS = 2 * N;
+
+  // the key of rank r is looked up with probability proportional to 1 / r,
+  // ranks are spread over the keys at random
+  std::vector<int> keys(N);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::mt19937 rng(2);
+  std::shuffle(keys.begin(), keys.end(), rng);
+  std::vector<double> weights(N);
+  for (size_t r = 0; r < N; ++r) {
+    weights[r] = 1.0 / static_cast<double>(r + 1);
+  }
+  std::discrete_distribution<size_t> rank(weights.begin(), weights.end());
+  std::vector<int> lookups(LOOKUPS);
+  for (int& k : lookups) {
+    // every other key is left out, so some lookups miss
+    k = keys[rank(rng)] * 2 + static_cast<int>(rng() % 2);
+  }
+
+  compare(
+      "zipfian_lookup", LOOKUPS,
+      [&](auto& c) {
+        for (int k : keys) {
+          c.insert(k * 2);
+        }
+      },
+      [&](auto& c) {
+        uint64_t found = 0;
+        for (int k : lookups) {
+          found += c.find(k) != c.end();
+        }
+        return found;
+      });
+}
+
+TEST_F(benchmark_performance_test, churn) {
+  std::vector<int> initial = random_keys(N, 3);
+  std::vector<int> erased = random_keys(N, 4);
+  std::vector<int> inserted = random_keys(N, 5);
+
+  compare(
+      "churn", 2 * N,
+      [&](auto& c) {
+        for (int k : initial) {
+          c.insert(k);
+        }
+      },
+      [&](auto& c) {
+        uint64_t changes = 0;
+        for (size_t i = 0; i < N; ++i) {
+          changes += c.erase(erased[i]);
+          changes += c.insert(inserted[i]).second;
+        }
+        return changes;
+      });
+}
@@ -0,0 +1,371 @@
+#include "btree-set.h"
+#include "element.h"
+#include "fault-injection.h"
+#include "pool-allocator.h"
+#include "test-utils.h"
+#include "tree-shape.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// element behind a pointer: btree_set needs keys that move without
+// throwing, copies and comparisons still reach the fault injection points
+// and the instances are still tracked
+class movable_element {
+public:
+  movable_element(int val) : ptr(std::make_unique<element>(val)) {}
+
+  movable_element(const movable_element& other) : ptr(std::make_unique<element>(*other.ptr)) {}
+
+  movable_element(movable_element&&) noexcept = default;
+
+  movable_element& operator=(const movable_element& other) {
+    ptr = std::make_unique<element>(*other.ptr);
+    return *this;
+  }
+
+  movable_element& operator=(movable_element&&) noexcept = default;
+
+  operator int() const {
+    return *ptr;
+  }
+
+  friend bool operator<(const movable_element& a, const movable_element& b) {
+    return *a.ptr < *b.ptr;
+  }
+
+private:
+  std::unique_ptr<element> ptr;
+};
+
+} // namespace
+
+template class btree_set<movable_element>;
+template class btree_set<int>;
+template class btree_set<int, 64, std::less<int>, pool_allocator<int>>;
+
+namespace {
+
+class btree_correctness_test : public base_test {};
+
+class btree_exception_safety_test : public base_test {};
+
+class btree_performance_test : public base_test {};
+
+// few keys per node, so that small sets already have several levels
+using small_btree = btree_set<int, 32>;
+
+} // namespace
+
+TEST_F(btree_correctness_test, default_ctor) {
+  btree_set<movable_element> c;
+  expect_empty(c);
+}
+
+TEST_F(btree_correctness_test, insert_find_erase) {
+  btree_set<movable_element> c;
+  mass_insert(c, {8, 3, 5, 4, 3, 1, 8, 8, 10, 9});
+  expect_eq(c, {1, 3, 4, 5, 8, 9, 10});
+  EXPECT_EQ(5, *c.find(5));
+  EXPECT_EQ(c.end(), c.find(6));
+  EXPECT_FALSE(c.insert(4).second);
+
+  EXPECT_EQ(1, c.erase(4));
+  EXPECT_EQ(0, c.erase(4));
+  EXPECT_EQ(8, *c.erase(c.find(5)));
+  expect_eq(c, {1, 3, 8, 9, 10});
+}
+
+TEST_F(btree_correctness_test, bounds) {
+  small_btree c;
+  for (int i = 0; i < 100; i += 2) {
+    c.insert(i);
+  }
+  EXPECT_EQ(c.begin(), c.lower_bound(-1));
+  EXPECT_EQ(10, *c.lower_bound(9));
+  EXPECT_EQ(10, *c.lower_bound(10));
+  EXPECT_EQ(12, *c.upper_bound(10));
+  EXPECT_EQ(c.end(), c.lower_bound(99));
+  EXPECT_EQ(c.end(), c.upper_bound(98));
+}
+
+TEST_F(btree_correctness_test, iteration) {
+  small_btree c;
+  for (int i = 100; i > 0; --i) {
+    c.insert(i);
+  }
+  int expected = 1;
+  for (int e : c) {
+    EXPECT_EQ(expected++, e);
+  }
+  EXPECT_EQ(101, expected);
+  for (auto it = c.rbegin(); it != c.rend(); ++it) {
+    EXPECT_EQ(--expected, *it);
+  }
+  EXPECT_EQ(100, *std::prev(c.end()));
+}
+
+TEST_F(btree_correctness_test, erase_returns_next) {
+  small_btree c;
+  for (int i = 0; i < 200; ++i) {
+    c.insert(i);
+  }
+  small_btree::iterator it = c.find(50);
+  while (it != c.end()) {
+    int val = *it;
+    it = c.erase(it);
+    if (it != c.end()) {
+      EXPECT_EQ(val + 1, *it);
+    }
+  }
+  EXPECT_EQ(50, c.size());
+  EXPECT_EQ(49, *std::prev(c.end()));
+}
+
+TEST_F(btree_correctness_test, nodes_fit_node_bytes) {
+  // 59 keys in a leaf, 18 keys and 20 children in an inner node
+  btree_set<int> c;
+  for (int i = 0; i < 100'000; ++i) {
+    c.insert(i * 7919 % 100'000);
+  }
+  tree_shape shape = c.shape();
+  EXPECT_EQ(100'000, shape.size);
+  // an inner node of more than 256 bytes would break the multiple
+  EXPECT_EQ(0, shape.node_bytes % 256);
+  // nodes are at least half full: at most 100'000 / 29 leaves and a
+  // ninth of that in inner nodes above them
+  EXPECT_LE(shape.node_bytes, 256 * (100'000 / 29 + 1) * 9 / 8 + 256 * shape.height);
+  EXPECT_LE(shape.height, 5);
+
+  // appended keys fill the nodes
+  std::vector<int> keys(100'000);
+  std::iota(keys.begin(), keys.end(), 0);
+  btree_set<int> sorted(sorted_unique, keys.begin(), keys.end());
+  EXPECT_LE(sorted.shape().node_bytes, 256 * (100'000 / 59 + 1) * 19 / 18 + 256 * 4);
+}
+
+TEST_F(btree_correctness_test, stays_half_full) {
+  std::mt19937 rng(3);
+  small_btree c;
+  std::set<int> expected;
+  for (int round = 0; round < 20; ++round) {
+    for (int i = 0; i < 2'000; ++i) {
+      int val = static_cast<int>(rng() % 5'000);
+      EXPECT_EQ(expected.insert(val).second, c.insert(val).second);
+    }
+    // erasing in runs empties whole nodes, so that merges go up the tree
+    int from = static_cast<int>(rng() % 5'000);
+    for (int val = from; val < from + 1'000; ++val) {
+      EXPECT_EQ(expected.erase(val), c.erase(val));
+    }
+    expect_eq(c, expected);
+    // nodes of 32 bytes hold 3 keys, every one but the root at least one,
+    // so there are at least 2^(h - 1) leaves and 2^h - 1 keys
+    tree_shape shape = c.shape();
+    EXPECT_LE(shape.height, std::bit_width(shape.size));
+    EXPECT_LE(shape.average_depth, static_cast<double>(shape.height));
+  }
+}
+
+TEST_F(btree_correctness_test, sorted_unique_ctor) {
+  for (int n : {0, 1, 3, 4, 17, 100, 1'000}) {
+    std::vector<int> keys(n);
+    for (int i = 0; i < n; ++i) {
+      keys[i] = 2 * i;
+    }
+    small_btree c(sorted_unique, keys.begin(), keys.end());
+    expect_eq(c, std::set<int>(keys.begin(), keys.end()));
+    c.insert(-1);
+    c.erase(0);
+    EXPECT_EQ(static_cast<size_t>(n) + (n == 0), c.size());
+  }
+}
+
+TEST_F(btree_correctness_test, insert_sorted) {
+  small_btree c;
+  std::set<int> expected;
+  for (int i = 0; i < 300; i += 3) {
+    c.insert(i);
+    expected.insert(i);
+  }
+  std::vector<int> added = {-5, 0, 1, 1, 2, 299, 300, 301, 301};
+  for (int i = 0; i < 300; ++i) {
+    added.push_back(i * 2 + 1000);
+  }
+  std::sort(added.begin(), added.end());
+  c.insert_sorted(added.begin(), added.end());
+  expected.insert(added.begin(), added.end());
+  expect_eq(c, expected);
+
+  // a few keys are inserted one by one
+  std::vector<int> few = {-7, 150};
+  c.insert_sorted(few.begin(), few.end());
+  expected.insert(few.begin(), few.end());
+  expect_eq(c, expected);
+}
+
+TEST_F(btree_correctness_test, pooled) {
+  btree_set<int, 64, std::less<int>, pool_allocator<int>> c;
+  for (int i = 0; i < 1'000; ++i) {
+    c.insert(i * 31 % 1'000);
+  }
+  auto copy = c;
+  EXPECT_NE(c.get_allocator(), copy.get_allocator());
+  for (int i = 0; i < 1'000; i += 2) {
+    copy.erase(i);
+  }
+  EXPECT_EQ(1'000, c.size());
+  EXPECT_EQ(500, copy.size());
+  EXPECT_EQ(1, *copy.begin());
+
+  auto moved = std::move(copy);
+  expect_empty(copy);
+  swap(moved, c);
+  EXPECT_EQ(500, c.size());
+  EXPECT_EQ(0, *moved.begin());
+}
+
+TEST_F(btree_correctness_test, transparent_lookup) {
+  btree_set<std::string, 64, std::less<>> c;
+  for (int i = 0; i < 50; ++i) {
+    c.emplace(std::to_string(i));
+  }
+  EXPECT_EQ("17", *c.find(std::string_view("17")));
+  EXPECT_EQ(c.end(), c.find(std::string_view("x")));
+  EXPECT_EQ("2", *c.lower_bound(std::string_view("2")));
+  EXPECT_EQ("20", *c.upper_bound(std::string_view("2")));
+  EXPECT_EQ(1, c.erase(std::string_view("17")));
+  EXPECT_EQ(49, c.size());
+}
+
+TEST_F(btree_correctness_test, floating_point_keys) {
+  btree_set<double> c;
+  for (int i = 0; i < 1000; ++i) {
+    c.insert(i * 0.5);
+  }
+  EXPECT_EQ(10.0, *c.lower_bound(9.75));
+  EXPECT_EQ(10.5, *c.upper_bound(10.0));
+  EXPECT_EQ(c.end(), c.find(0.25));
+}
+
+TEST_F(btree_exception_safety_test, copy_ctor) {
+  faulty_run([] {
+    btree_set<movable_element, 64> c;
+    {
+      fault_injection_disable dg;
+      for (int i = 0; i < 20; ++i) {
+        c.insert(i);
+      }
+    }
+    btree_set<movable_element, 64> c2 = c;
+    fault_injection_disable dg;
+    EXPECT_TRUE(std::equal(c.begin(), c.end(), c2.begin(), c2.end()));
+  });
+}
+
+TEST_F(btree_exception_safety_test, sorted_unique_ctor) {
+  faulty_run([] {
+    std::vector<movable_element> keys;
+    {
+      fault_injection_disable dg;
+      for (int i = 0; i < 50; ++i) {
+        keys.emplace_back(i);
+      }
+    }
+    btree_set<movable_element, 64> c(sorted_unique, keys.begin(), keys.end());
+    fault_injection_disable dg;
+    EXPECT_TRUE(std::equal(c.begin(), c.end(), keys.begin(), keys.end()));
+  });
+}
+
+TEST_F(btree_exception_safety_test, insert_new_root) {
+  faulty_run([] {
+    btree_set<movable_element, 64> c;
+    {
+      fault_injection_disable dg;
+      for (int i = 0; i < 20; ++i) {
+        c.insert(i);
+      }
+    }
+    size_t size = c.size();
+    try {
+      c.insert(100);
+    } catch (...) {
+      fault_injection_disable dg;
+      EXPECT_EQ(size, c.size());
+      EXPECT_EQ(c.end(), c.find(100));
+      throw;
+    }
+  });
+}
+
+TEST_F(btree_exception_safety_test, insert_and_erase_across_levels) {
+  faulty_run([] {
+    btree_set<movable_element, 64> c;
+    {
+      fault_injection_disable dg;
+      for (int i = 0; i < 60; ++i) {
+        c.insert(2 * i);
+      }
+    }
+    // odd keys fill the leaves of the front, which split up to the root
+    for (int i = 0; i < 15; ++i) {
+      strong_exception_safety_guard sg(c);
+      c.insert(2 * i + 1);
+    }
+    // erasing at begin() and by value further on borrows from and merges
+    // nodes back up to the root
+    for (int i = 0; i < 40; ++i) {
+      strong_exception_safety_guard sg(c);
+      if (i % 2 == 0) {
+        EXPECT_EQ(1, c.erase(movable_element(100 - i)));
+      } else {
+        c.erase(c.begin());
+      }
+    }
+    fault_injection_disable dg;
+    EXPECT_EQ(35, c.size());
+    EXPECT_EQ(20, *c.begin());
+    EXPECT_EQ(118, *c.rbegin());
+  });
+}
+
+TEST_F(btree_performance_test, insert_and_lookup) {
+  constexpr int N = 1'000'000;
+
+  std::mt19937 rng(1);
+  btree_set<int> c;
+  for (int i = 0; i < N; ++i) {
+    c.insert(static_cast<int>(rng() % (4 * N)));
+  }
+  size_t found = 0;
+  for (int i = 0; i < 4 * N; i += 2) {
+    found += c.find(i) != c.end();
+  }
+  EXPECT_LE(found, c.size());
+}
+
+TEST_F(btree_performance_test, erase_ascending) {
+  constexpr int N = 1'000'000;
+
+  btree_set<int> c;
+  for (int i = 0; i < N; ++i) {
+    c.insert(i);
+  }
+  for (int i = 1; i < N; ++i) {
+    c.erase(c.begin());
+  }
+  EXPECT_EQ(N - 1, *c.begin());
+}
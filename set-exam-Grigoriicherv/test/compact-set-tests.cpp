@@ -0,0 +1,232 @@
+#include "compact-set.h"
+#include "element.h"
+#include "fault-injection.h"
+#include "set.h"
+#include "test-utils.h"
+
+#include <gtest/gtest.h>
+
+#include <bit>
+#include <iterator>
+#include <random>
+#include <set>
+
+template class compact_set<element>;
+template class compact_set<int>;
+
+namespace {
+
+class compact_correctness_test : public base_test {};
+
+class compact_exception_safety_test : public base_test {};
+
+class compact_performance_test : public base_test {};
+
+using compact_container = compact_set<element>;
+
+} // namespace
+
+TEST_F(compact_correctness_test, default_ctor) {
+  compact_container c;
+  expect_empty(c);
+  EXPECT_EQ(c.end(), c.find(1));
+  EXPECT_EQ(0, c.capacity());
+}
+
+TEST_F(compact_correctness_test, insert_find_erase) {
+  compact_container c;
+  mass_insert(c, {8, 3, 5, 4, 3, 1, 8, 8, 10, 9});
+  expect_eq(c, {1, 3, 4, 5, 8, 9, 10});
+  expect_eq(reverse_view(c), {10, 9, 8, 5, 4, 3, 1});
+  EXPECT_EQ(5, *c.find(5));
+  EXPECT_EQ(c.end(), c.find(6));
+  EXPECT_EQ(8, *c.lower_bound(6));
+  EXPECT_EQ(9, *c.upper_bound(8));
+  EXPECT_EQ(c.end(), c.upper_bound(10));
+  EXPECT_FALSE(c.insert(4).second);
+
+  EXPECT_EQ(1, c.erase(4));
+  EXPECT_EQ(0, c.erase(4));
+  EXPECT_EQ(8, *c.erase(c.find(5)));
+  expect_eq(c, {1, 3, 8, 9, 10});
+}
+
+TEST_F(compact_correctness_test, iterators_survive_growth) {
+  compact_set<int> c;
+  auto first = c.insert(0).first;
+  auto last = c.insert(1).first;
+  for (int i = 2; i < 1000; ++i) {
+    c.insert(i);
+  }
+  EXPECT_EQ(0, *first);
+  EXPECT_EQ(1, *last);
+  EXPECT_EQ(2, *std::next(last));
+  EXPECT_EQ(999, *std::prev(c.end()));
+}
+
+TEST_F(compact_correctness_test, erased_slots_are_reused) {
+  compact_set<int> c;
+  c.reserve(100);
+  size_t capacity = c.capacity();
+  EXPECT_LE(100, capacity);
+  for (int round = 0; round < 10; ++round) {
+    for (int i = 0; i < 100; ++i) {
+      c.insert(round * 100 + i);
+    }
+    for (int i = 0; i < 100; ++i) {
+      c.erase(round * 100 + i);
+    }
+  }
+  expect_empty(c);
+  EXPECT_EQ(capacity, c.capacity());
+
+  c.insert(1);
+  c.clear();
+  expect_empty(c);
+  EXPECT_EQ(capacity, c.capacity());
+  c.insert(2);
+  expect_eq(c, {2});
+}
+
+TEST_F(compact_correctness_test, iterators_survive_swap_and_move) {
+  compact_container c1, c2;
+  mass_insert(c1, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+  c2.insert(11);
+  compact_container::const_iterator b = ++++c1.begin();
+  compact_container::const_iterator e1 = c1.end();
+  compact_container::const_iterator only = c2.begin();
+  EXPECT_NE(c1.end(), c2.end());
+
+  swap(c1, c2);
+  EXPECT_EQ(3, *b);
+  EXPECT_EQ(4, *++b);
+  EXPECT_EQ(c2.end(), std::next(b, 7));
+  EXPECT_EQ(e1, c2.end());
+  EXPECT_EQ(11, *only);
+  EXPECT_EQ(c1.begin(), only);
+
+  compact_container moved = std::move(c2);
+  EXPECT_EQ(4, *b);
+  EXPECT_EQ(moved.end(), std::next(b, 7));
+  moved.erase(b);
+  expect_eq(moved, {1, 2, 3, 5, 6, 7, 8, 9, 10});
+
+  c2 = std::move(c1);
+  EXPECT_EQ(11, *only);
+  EXPECT_EQ(c2.end(), std::next(only));
+}
+
+TEST_F(compact_correctness_test, memory_per_element) {
+  // slots of 16 bytes for int, the array at most half empty after growth
+  compact_set<int> c;
+  set<int> nodes;
+  for (int i = 0; i < 100'000; ++i) {
+    c.insert(i);
+    nodes.insert(i);
+    if (i >= 1000 && i % 97 == 0) {
+      EXPECT_LE(c.shape().node_bytes, 24 * c.size() + 64);
+    }
+  }
+  tree_shape shape = c.shape();
+  EXPECT_LE(2 * shape.node_bytes, nodes.shape().node_bytes + 16 * nodes.size());
+
+  c.shrink_to_fit();
+  EXPECT_EQ(c.size(), c.capacity());
+  EXPECT_EQ(16 * (c.size() + 1), c.shape().node_bytes);
+  expect_eq(c, nodes);
+}
+
+TEST_F(compact_correctness_test, stays_balanced) {
+  std::mt19937 rng(7);
+  compact_set<int> c;
+  std::set<int> expected;
+  for (int i = 0; i < 50'000; ++i) {
+    int val = static_cast<int>(rng() % 5000);
+    if (i % 4 == 0) {
+      EXPECT_EQ(expected.erase(val), c.erase(val));
+    } else {
+      // runs of ascending keys, the worst case of an unbalanced tree
+      EXPECT_EQ(expected.insert(val + i % 64).second, c.insert(val + i % 64).second);
+    }
+    if (i % 1000 == 0) {
+      tree_shape shape = c.shape();
+      EXPECT_EQ(expected.size(), shape.size);
+      EXPECT_LE(shape.height, 2 * std::bit_width(shape.size + 1));
+    }
+  }
+  expect_eq(c, expected);
+}
+
+TEST_F(compact_exception_safety_test, copy_ctor) {
+  faulty_run([] {
+    compact_container c;
+    {
+      fault_injection_disable dg;
+      for (int i = 0; i < 20; ++i) {
+        c.insert(i);
+      }
+      c.erase(7);
+    }
+    compact_container c2 = c;
+    fault_injection_disable dg;
+    expect_eq(c2, std::set<int>{0, 1, 2, 3, 4, 5, 6, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19});
+  });
+}
+
+TEST_F(compact_exception_safety_test, insert) {
+  faulty_run([] {
+    compact_container c;
+    {
+      fault_injection_disable dg;
+      // 15 elements fill the first array, so the next insert grows it
+      for (int i = 0; i < 15; ++i) {
+        c.insert(i * 2);
+      }
+    }
+    strong_exception_safety_guard sg(c);
+    c.insert(5);
+  });
+}
+
+TEST_F(compact_exception_safety_test, erase) {
+  faulty_run([] {
+    compact_container c;
+    mass_insert(c, {3, 2, 4, 1, 7, 6, 5});
+
+    strong_exception_safety_guard sg(c);
+    c.erase(3);
+    fault_injection_disable dg;
+    expect_eq(c, {1, 2, 4, 5, 6, 7});
+  });
+}
+
+TEST_F(compact_performance_test, insert_and_lookup) {
+  constexpr int N = 1'000'000;
+
+  std::mt19937 rng(1);
+  compact_set<int> c;
+  for (int i = 0; i < N; ++i) {
+    c.insert(static_cast<int>(rng() % (4 * N)));
+  }
+  size_t found = 0;
+  for (int i = 0; i < 4 * N; i += 2) {
+    found += c.find(i) != c.end();
+  }
+  EXPECT_LE(found, c.size());
+}
+
+TEST_F(compact_performance_test, churn) {
+  constexpr int N = 1'000'000;
+
+  std::mt19937 rng(2);
+  compact_set<int> c;
+  for (int i = 0; i < N; ++i) {
+    c.insert(i);
+  }
+  size_t capacity = c.capacity();
+  for (int i = 0; i < N; ++i) {
+    c.erase(static_cast<int>(rng() % N));
+    c.insert(static_cast<int>(rng() % N));
+  }
+  EXPECT_EQ(capacity, c.capacity());
+}
@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <iostream>
+#include <new>
 #include <vector>
 
 namespace {
@@ -143,6 +144,30 @@ void* operator new[](size_t count) {
   return injected_allocate(count);
 }
 
+void* operator new(size_t count, const std::nothrow_t&) noexcept {
+  try {
+    return injected_allocate(count);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void* operator new[](size_t count, const std::nothrow_t&) noexcept {
+  try {
+    return injected_allocate(count);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  injected_deallocate(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  injected_deallocate(ptr);
+}
+
 void operator delete(void* ptr) noexcept {
   injected_deallocate(ptr);
 }
@@ -0,0 +1,119 @@
+#include "element.h"
+#include "fault-injection.h"
+#include "frozen-set.h"
+#include "set.h"
+#include "test-utils.h"
+
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+
+template class frozen_set<element>;
+
+namespace {
+
+class frozen_correctness_test : public base_test {};
+
+class frozen_exception_safety_test : public base_test {};
+
+class frozen_performance_test : public base_test {};
+
+} // namespace
+
+TEST_F(frozen_correctness_test, empty) {
+  container c;
+  frozen_set<element> f = c.freeze();
+  expect_empty(f);
+  EXPECT_EQ(f.end(), f.find(1));
+  EXPECT_EQ(f.end(), f.lower_bound(1));
+  EXPECT_EQ(f.end(), f.upper_bound(1));
+}
+
+TEST_F(frozen_correctness_test, freeze) {
+  container c;
+  mass_insert(c, {8, 3, 5, 4, 3, 1, 8, 8, 10, 9});
+  frozen_set<element> f = c.freeze();
+  c.clear();
+
+  expect_eq(f, {1, 3, 4, 5, 8, 9, 10});
+  expect_eq(reverse_view(f), {10, 9, 8, 5, 4, 3, 1});
+  EXPECT_EQ(5, *f.find(5));
+  EXPECT_EQ(f.end(), f.find(6));
+  EXPECT_EQ(f.begin(), f.lower_bound(0));
+  EXPECT_EQ(8, *f.lower_bound(6));
+  EXPECT_EQ(9, *f.upper_bound(8));
+  EXPECT_EQ(f.end(), f.upper_bound(10));
+  EXPECT_EQ(10, *std::prev(f.end()));
+}
+
+TEST_F(frozen_correctness_test, matches_std_set) {
+  std::mt19937 rng(42);
+  for (size_t n = 0; n < 100; ++n) {
+    std::set<int> expected;
+    while (expected.size() < n) {
+      expected.insert(static_cast<int>(rng() % 300));
+    }
+    frozen_set<int> f(sorted_unique, expected.begin(), expected.end());
+    expect_eq(f, expected);
+    for (int i = -1; i <= 300; ++i) {
+      EXPECT_EQ(std::distance(expected.begin(), expected.lower_bound(i)), std::distance(f.begin(), f.lower_bound(i)));
+      EXPECT_EQ(std::distance(expected.begin(), expected.upper_bound(i)), std::distance(f.begin(), f.upper_bound(i)));
+      EXPECT_EQ(expected.count(i) == 1, f.find(i) != f.end());
+    }
+  }
+}
+
+TEST_F(frozen_correctness_test, copy_and_move) {
+  set<int> c;
+  mass_insert_balanced(c, 100);
+  frozen_set<int> f = c.freeze();
+  frozen_set<int> copy = f;
+  expect_eq(copy, c);
+
+  frozen_set<int> moved = std::move(copy);
+  expect_empty(copy);
+  expect_eq(moved, c);
+
+  copy = moved;
+  expect_eq(copy, c);
+}
+
+TEST_F(frozen_correctness_test, transparent_lookup) {
+  set<std::string, std::less<>> c;
+  mass_insert(c, {std::string("pear"), std::string("apple"), std::string("plum")});
+  frozen_set<std::string, std::less<>> f = c.freeze();
+
+  EXPECT_EQ("pear", *f.find(std::string_view("pear")));
+  EXPECT_EQ(f.end(), f.find(std::string_view("fig")));
+  EXPECT_EQ("pear", *f.lower_bound(std::string_view("banana")));
+  EXPECT_EQ("plum", *f.upper_bound(std::string_view("pear")));
+}
+
+TEST_F(frozen_exception_safety_test, freeze) {
+  faulty_run([] {
+    container c;
+    mass_insert(c, {3, 2, 4, 1, 7, 5});
+    frozen_set<element> f = c.freeze();
+    expect_eq(f, {1, 2, 3, 4, 5, 7});
+  });
+}
+
+TEST_F(frozen_performance_test, lookups) {
+  constexpr size_t N = 1'000'000;
+  constexpr size_t K = 4'000'000;
+
+  set<int> c;
+  mass_insert_balanced(c, N);
+  frozen_set<int> f = c.freeze();
+
+  std::mt19937 rng(1);
+  size_t found = 0;
+  for (size_t i = 0; i < K; ++i) {
+    found += f.find(static_cast<int>(rng() % (2 * N))) != f.end();
+  }
+  EXPECT_LE(found, K);
+}
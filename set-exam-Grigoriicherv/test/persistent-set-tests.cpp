@@ -0,0 +1,283 @@
+#include "element.h"
+#include "fault-injection.h"
+#include "persistent-set.h"
+#include "test-utils.h"
+#include "tree-shape.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+template class persistent_set<element>;
+template class persistent_set<int>;
+
+namespace {
+
+class persistent_correctness_test : public base_test {};
+
+class persistent_exception_safety_test : public base_test {};
+
+class persistent_performance_test : public base_test {};
+
+using persistent_container = persistent_set<element>;
+
+// int counting its copies
+struct counted {
+  explicit counted(int val) : val(val) {}
+
+  counted(const counted& other) : val(other.val) {
+    copies++;
+  }
+
+  counted& operator=(const counted&) = default;
+
+  friend bool operator<(const counted& a, const counted& b) {
+    return a.val < b.val;
+  }
+
+  static inline size_t copies = 0;
+
+  int val;
+};
+
+} // namespace
+
+TEST_F(persistent_correctness_test, default_ctor) {
+  persistent_container c;
+  expect_empty(c);
+  EXPECT_EQ(c.end(), c.find(1));
+}
+
+TEST_F(persistent_correctness_test, insert_find_erase) {
+  persistent_container c;
+  mass_insert(c, {8, 3, 5, 4, 3, 1, 8, 8, 10, 9});
+  expect_eq(c, {1, 3, 4, 5, 8, 9, 10});
+  expect_eq(reverse_view(c), {10, 9, 8, 5, 4, 3, 1});
+  EXPECT_EQ(5, *c.find(5));
+  EXPECT_EQ(c.end(), c.find(6));
+  EXPECT_EQ(8, *c.lower_bound(6));
+  EXPECT_EQ(9, *c.upper_bound(8));
+  EXPECT_EQ(c.end(), c.upper_bound(10));
+
+  std::pair<persistent_container::iterator, bool> res = c.insert(4);
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(4, *res.first);
+  res = c.insert(7);
+  EXPECT_TRUE(res.second);
+  EXPECT_EQ(8, *std::next(res.first));
+
+  EXPECT_EQ(1, c.erase(4));
+  EXPECT_EQ(0, c.erase(4));
+  expect_eq(c, {1, 3, 5, 7, 8, 9, 10});
+}
+
+TEST_F(persistent_correctness_test, snapshots_are_unchanged) {
+  persistent_container c;
+  mass_insert(c, {5, 3, 7});
+  persistent_container s1 = c.snapshot();
+  c.insert(1);
+  c.erase(5);
+  persistent_container s2 = c.snapshot();
+  c.clear();
+  c.insert(42);
+
+  expect_eq(s1, {3, 5, 7});
+  expect_eq(s2, {1, 3, 7});
+  expect_eq(c, {42});
+}
+
+TEST_F(persistent_correctness_test, versions_are_independent) {
+  // every version keeps what it had when it was taken, whatever the
+  // later versions and the other snapshots do
+  std::mt19937 rng(5);
+  persistent_set<int> c;
+  std::vector<std::pair<persistent_set<int>, std::set<int>>> versions;
+  std::set<int> expected;
+  for (int round = 0; round < 30; ++round) {
+    for (int i = 0; i < 200; ++i) {
+      int val = static_cast<int>(rng() % 2'000);
+      c.insert(val);
+      expected.insert(val);
+    }
+    for (int i = 0; i < 100; ++i) {
+      int val = static_cast<int>(rng() % 2'000);
+      c.erase(val);
+      expected.erase(val);
+    }
+    versions.emplace_back(c.snapshot(), expected);
+    // a change to an old snapshot starts its own line of versions
+    persistent_set<int> branch = versions[rng() % versions.size()].first;
+    branch.insert(-round - 1);
+    branch.erase(*branch.begin());
+  }
+  expect_eq(c, expected);
+  for (const auto& [version, contents] : versions) {
+    expect_eq(version, contents);
+  }
+}
+
+TEST_F(persistent_correctness_test, updates_copy_only_the_path) {
+  persistent_set<counted> c;
+  for (int i = 0; i < 10'000; ++i) {
+    c.insert(counted(i * 7 % 10'000));
+  }
+  size_t height = c.shape().height;
+  persistent_set<counted> s = c.snapshot();
+
+  counted::copies = 0;
+  c.insert(counted(-1));
+  EXPECT_LE(counted::copies, height + 2);
+
+  counted::copies = 0;
+  c.erase(counted(5'000));
+  EXPECT_LE(counted::copies, height + 2);
+
+  EXPECT_EQ(10'000, s.size());
+  EXPECT_NE(s.end(), s.find(counted(5'000)));
+  EXPECT_EQ(s.end(), s.find(counted(-1)));
+}
+
+TEST_F(persistent_correctness_test, stays_weight_balanced) {
+  // a subtree weighs at most 3/4 of its parent, so a tree of n nodes is at
+  // most log_{4/3}((n + 1) / 2) + 1 nodes high
+  auto expect_balanced = [](const persistent_set<int>& c) {
+    tree_shape shape = c.shape();
+    EXPECT_EQ(c.size(), shape.size);
+    double bound = std::log(static_cast<double>(shape.size + 1) / 2) / std::log(4.0 / 3.0) + 1;
+    EXPECT_LE(static_cast<double>(shape.height), std::max(bound, 1.0));
+  };
+
+  persistent_set<int> ascending;
+  persistent_set<int> descending;
+  for (int i = 0; i < 50'000; ++i) {
+    ascending.insert(i);
+    descending.insert(-i);
+  }
+  expect_balanced(ascending);
+  expect_balanced(descending);
+
+  // erasing one side leaves the other side to carry the tree
+  for (int i = 0; i < 40'000; ++i) {
+    ascending.erase(i);
+    descending.erase(-i);
+    if (i % 4'999 == 0) {
+      expect_balanced(ascending);
+      expect_balanced(descending);
+    }
+  }
+  expect_balanced(ascending);
+  expect_balanced(descending);
+}
+
+TEST_F(persistent_correctness_test, iteration) {
+  persistent_set<int> c;
+  for (int i = 100; i > 0; --i) {
+    c.insert(i);
+  }
+  int expected = 1;
+  for (int e : c) {
+    EXPECT_EQ(expected++, e);
+  }
+  EXPECT_EQ(101, expected);
+  for (auto it = c.rbegin(); it != c.rend(); ++it) {
+    EXPECT_EQ(--expected, *it);
+  }
+  EXPECT_EQ(100, *std::prev(c.end()));
+}
+
+TEST_F(persistent_correctness_test, emplace_and_transparent_lookup) {
+  persistent_set<std::string, std::less<>> c;
+  c.emplace(3, 'a');
+  c.emplace("pear");
+  EXPECT_FALSE(c.emplace("pear").second);
+  EXPECT_EQ("aaa", *c.find(std::string_view("aaa")));
+  EXPECT_EQ(c.end(), c.find(std::string_view("fig")));
+  EXPECT_EQ("pear", *c.lower_bound(std::string_view("b")));
+  EXPECT_EQ(c.end(), c.upper_bound(std::string_view("pear")));
+  EXPECT_EQ(1, c.erase(std::string_view("aaa")));
+  EXPECT_EQ(1, c.size());
+}
+
+TEST_F(persistent_correctness_test, concurrent_readers) {
+  constexpr int N = 2000;
+
+  atomic_persistent_set<int> published;
+  std::atomic<bool> done = false;
+  std::atomic<bool> failed = false;
+
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&] {
+      while (!done) {
+        persistent_set<int> version = published.load();
+        // versions hold 0 .. size - 1
+        int expected = 0;
+        for (int e : version) {
+          failed = failed || e != expected++;
+        }
+        failed = failed || static_cast<size_t>(expected) != version.size();
+      }
+    });
+  }
+
+  persistent_set<int> c;
+  for (int i = 0; i < N; ++i) {
+    c.insert(i);
+    published.store(c);
+  }
+  done = true;
+  for (std::thread& t : readers) {
+    t.join();
+  }
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(N, published.load().size());
+}
+
+TEST_F(persistent_exception_safety_test, insert) {
+  faulty_run([] {
+    persistent_container c;
+    mass_insert(c, {3, 2, 4, 1, 7, 6});
+
+    strong_exception_safety_guard sg(c);
+    c.insert(5);
+    expect_eq(c, {1, 2, 3, 4, 5, 6, 7});
+  });
+}
+
+TEST_F(persistent_exception_safety_test, erase) {
+  faulty_run([] {
+    persistent_container c;
+    mass_insert(c, {3, 2, 4, 1, 7, 6, 5});
+    persistent_container s = c.snapshot();
+
+    strong_exception_safety_guard sg(c);
+    c.erase(3);
+    fault_injection_disable dg;
+    expect_eq(c, {1, 2, 4, 5, 6, 7});
+    expect_eq(s, {1, 2, 3, 4, 5, 6, 7});
+  });
+}
+
+TEST_F(persistent_performance_test, snapshot_while_inserting) {
+  constexpr int N = 1'000'000;
+
+  std::mt19937 rng(1);
+  persistent_set<int> c;
+  std::vector<persistent_set<int>> versions;
+  for (int i = 0; i < N; ++i) {
+    c.insert(static_cast<int>(rng() % (4 * N)));
+    if (i % 100'000 == 0) {
+      versions.push_back(c.snapshot());
+    }
+  }
+  EXPECT_LE(versions.back().size(), c.size());
+}
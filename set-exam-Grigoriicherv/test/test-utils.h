@@ -8,8 +8,10 @@
 
 #include <bit>
 #include <concepts>
+#include <filesystem>
 #include <initializer_list>
 #include <ostream>
+#include <string>
 
 template class set<element>;
 using container = set<element>;
@@ -137,6 +139,22 @@ private:
   C expected;
 };
 
+// path in the temporary directory, the file is removed with the object
+class temp_file {
+public:
+  explicit temp_file(const std::string& name)
+      : path(std::filesystem::temp_directory_path() / ("set-exam-" + name)) {}
+
+  temp_file(const temp_file&) = delete;
+
+  ~temp_file() {
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+  }
+
+  const std::filesystem::path path;
+};
+
 class base_test : public ::testing::Test {
 protected:
   element::no_new_instances_guard instances_guard;
@@ -1,13 +1,29 @@
 #include "element.h"
 #include "fault-injection.h"
+#include "pool-allocator.h"
 #include "set.h"
 #include "test-utils.h"
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <iterator>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 static_assert(!std::is_constructible_v<container::iterator, std::nullptr_t>,
               "iterator should not be constructible from nullptr");
@@ -18,6 +34,17 @@ static_assert(!std::is_constructible_v<container::reverse_iterator, std::nullptr
 static_assert(!std::is_constructible_v<container::const_reverse_iterator, std::nullptr_t>,
               "const_reverse_iterator should not be constructible from nullptr");
 
+template class set<element, std::less<element>, pool_allocator<element>>;
+using pooled_container = set<element, std::less<element>, pool_allocator<element>>;
+
+template class set<element, std::less<element>, std::allocator<element>, true>;
+using ranked_container = set<element, std::less<element>, std::allocator<element>, true>;
+
+template class set<element, std::less<element>, std::allocator<element>, false, true>;
+using threaded_container = set<element, std::less<element>, std::allocator<element>, false, true>;
+
+template class set<int, std::less<int>, std::allocator<int>, true, true>;
+
 namespace {
 
 class correctness_test : public base_test {};
@@ -34,6 +61,39 @@ class random_test : public base_test {};
 
 void magic(const element&) {}
 
+// threads the recording_allocators of any type allocated on
+struct allocation_threads {
+  static inline std::mutex mutex;
+  static inline std::set<std::thread::id> ids;
+};
+
+// stateless and always equal, but not declared thread-safe
+template <typename T>
+struct recording_allocator {
+  using value_type = T;
+
+  recording_allocator() = default;
+
+  template <typename U>
+  recording_allocator(const recording_allocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    {
+      std::lock_guard lock(allocation_threads::mutex);
+      allocation_threads::ids.insert(std::this_thread::get_id());
+    }
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* ptr, size_t n) noexcept {
+    std::allocator<T>().deallocate(ptr, n);
+  }
+
+  friend bool operator==(const recording_allocator&, const recording_allocator&) noexcept {
+    return true;
+  }
+};
+
 } // namespace
 
 TEST_F(correctness_test, default_ctor) {
@@ -779,6 +839,23 @@ TEST_F(correctness_test, erase_val_return_value_2) {
   EXPECT_EQ(0, i);
 }
 
+TEST_F(correctness_test, erase_keeps_other_iterators) {
+  container c;
+  mass_insert(c, {8, 4, 12, 2, 6, 10, 14, 1, 3, 5, 7, 9, 11, 13, 15});
+  container::iterator i4 = c.find(4);
+  container::iterator i9 = c.find(9);
+
+  c.erase(c.find(8));
+  c.erase(c.find(5));
+  c.erase(c.find(2));
+
+  EXPECT_EQ(4, *i4);
+  EXPECT_EQ(9, *i9);
+  EXPECT_EQ(i9, std::next(i4, 3));
+  EXPECT_EQ(c.end(), c.find(8));
+  expect_eq(c, {1, 3, 4, 6, 7, 9, 10, 11, 12, 13, 14, 15});
+}
+
 TEST_F(correctness_test, erase_iterators) {
   container c;
   mass_insert(c, {8, 2, 6, 10, 3, 1, 9, 7});
@@ -866,6 +943,630 @@ TEST_F(correctness_test, upper_bounds) {
   EXPECT_EQ(std::next(c.begin(), 7), c.upper_bound(11));
 }
 
+TEST_F(correctness_test, pool_allocator) {
+  pooled_container c;
+  mass_insert(c, {8, 3, 5, 4, 1, 10, 9});
+  c.erase(5);
+  c.erase(c.begin());
+  c.insert(2);
+  expect_eq(c, {2, 3, 4, 8, 9, 10});
+
+  pooled_container c2 = c;
+  EXPECT_FALSE(c.get_allocator() == c2.get_allocator());
+  c.clear();
+  expect_empty(c);
+  expect_eq(c2, {2, 3, 4, 8, 9, 10});
+
+  c.insert(7);
+  swap(c, c2);
+  expect_eq(c, {2, 3, 4, 8, 9, 10});
+  expect_eq(c2, {7});
+}
+
+TEST_F(correctness_test, pool_allocator_trivial_clear) {
+  set<int, std::less<int>, pool_allocator<int>> c;
+  mass_insert(c, {3, 1, 2});
+  c.clear();
+  expect_empty(c);
+  mass_insert(c, {5, 4});
+  expect_eq(c, {4, 5});
+
+  pool_allocator<int> shared;
+  set<int, std::less<int>, pool_allocator<int>> c2(shared);
+  mass_insert(c2, {3, 1, 2});
+  c2.clear();
+  expect_empty(c2);
+}
+
+TEST_F(correctness_test, pool_reserve_is_contiguous) {
+  node_pool pool;
+  ASSERT_TRUE(pool.fits(sizeof(int), alignof(int)));
+  const size_t block = sizeof(void*);
+  std::vector<void*> blocks;
+  for (int i = 0; i < 40; ++i) {
+    blocks.push_back(pool.allocate());
+  }
+  for (int i = 0; i < 40; i += 2) {
+    pool.deallocate(blocks[i]);
+  }
+
+  // reserved blocks come before the ones on the free list, here from the
+  // rest of the current slab
+  pool.reserve(3);
+  char* next = static_cast<char*>(pool.allocate());
+  EXPECT_EQ(next + block, pool.allocate());
+  EXPECT_EQ(next + 2 * block, pool.allocate());
+  EXPECT_EQ(blocks[38], pool.allocate());
+
+  // and here from a new slab
+  pool.reserve(10'000);
+  char* first = static_cast<char*>(pool.allocate());
+  for (size_t i = 1; i < 10'000; ++i) {
+    ASSERT_EQ(first + i * block, pool.allocate());
+  }
+}
+
+TEST_F(correctness_test, sorted_unique_ctor) {
+  std::vector<element> elems = {1, 2, 4, 5, 7, 8, 9};
+  container c(sorted_unique, elems.begin(), elems.end());
+  expect_eq(c, {1, 2, 4, 5, 7, 8, 9});
+  EXPECT_EQ(std::next(c.begin(), 2), c.find(4));
+
+  container empty(sorted_unique, elems.begin(), elems.begin());
+  expect_empty(empty);
+}
+
+TEST_F(correctness_test, insert_sorted) {
+  container c;
+  mass_insert(c, {8, 3, 5, 1});
+  container::const_iterator it = c.find(5);
+
+  std::vector<element> elems = {0, 2, 2, 3, 5, 6, 9, 10};
+  c.insert_sorted(elems.begin(), elems.end());
+  expect_eq(c, {0, 1, 2, 3, 5, 6, 8, 9, 10});
+  EXPECT_EQ(5, *it);
+  EXPECT_EQ(it, c.find(5));
+
+  c.insert_sorted(elems.begin(), elems.begin() + 1);
+  expect_eq(c, {0, 1, 2, 3, 5, 6, 8, 9, 10});
+}
+
+TEST_F(correctness_test, insert_with_hint) {
+  container c;
+  container::iterator it = c.insert(c.end(), 5);
+  EXPECT_EQ(5, *it);
+  it = c.insert(it, 6);
+  it = c.insert(it, 4);
+  EXPECT_EQ(4, *it);
+  it = c.insert(c.end(), 1);
+  EXPECT_EQ(c.begin(), it);
+  it = c.insert(c.begin(), 9);
+  EXPECT_EQ(9, *it);
+  it = c.insert(c.find(9), 6);
+  EXPECT_EQ(c.find(6), it);
+  expect_eq(c, {1, 4, 5, 6, 9});
+}
+
+TEST_F(correctness_test, emplace_hint) {
+  container c;
+  mass_insert(c, {1, 3, 7});
+  container::iterator it = c.emplace_hint(c.find(3), 2);
+  EXPECT_EQ(2, *it);
+  it = c.emplace_hint(c.begin(), 7);
+  EXPECT_EQ(std::prev(c.end()), it);
+  expect_eq(c, {1, 2, 3, 7});
+}
+
+TEST_F(correctness_test, move_ctor) {
+  container c;
+  mass_insert(c, {3, 1, 2});
+  container::const_iterator it = c.find(2);
+
+  container c2 = std::move(c);
+  expect_empty(c);
+  expect_eq(c2, {1, 2, 3});
+  EXPECT_EQ(it, c2.find(2));
+
+  c.insert(7);
+  expect_eq(c, {7});
+}
+
+TEST_F(correctness_test, move_assignment) {
+  container c;
+  mass_insert(c, {3, 1, 2});
+  container c2;
+  mass_insert(c2, {5, 6});
+
+  c2 = std::move(c);
+  expect_empty(c);
+  expect_eq(c2, {1, 2, 3});
+
+  pooled_container p;
+  mass_insert(p, {4, 8});
+  pooled_container p2;
+  p2 = std::move(p);
+  expect_eq(p2, {4, 8});
+  p.insert(1);
+  expect_eq(p, {1});
+}
+
+TEST_F(correctness_test, move_only_values) {
+  set<std::unique_ptr<int>> c;
+  auto p = std::make_unique<int>(1);
+  int* raw = p.get();
+  EXPECT_TRUE(c.insert(std::move(p)).second);
+  EXPECT_EQ(nullptr, p);
+
+  auto [it, inserted] = c.emplace(new int(2));
+  EXPECT_TRUE(inserted);
+  EXPECT_EQ(2, **it);
+  it = c.emplace_hint(c.end(), new int(3));
+  EXPECT_EQ(3, **it);
+  EXPECT_EQ(3, c.size());
+
+  set<std::unique_ptr<int>> c2 = std::move(c);
+  EXPECT_EQ(3, c2.size());
+  std::unique_ptr<int> key(raw);
+  EXPECT_EQ(raw, c2.find(key)->get());
+  static_cast<void>(key.release());
+}
+
+TEST_F(correctness_test, extract_and_insert_node) {
+  container c;
+  mass_insert(c, {1, 2, 3, 4});
+
+  container::node_type nh = c.extract(c.find(2));
+  EXPECT_FALSE(nh.empty());
+  EXPECT_EQ(2, nh.value());
+  expect_eq(c, {1, 3, 4});
+  EXPECT_TRUE(c.extract(10).empty());
+
+  nh.value() = 7;
+  container c2;
+  mass_insert(c2, {7});
+  auto res = c2.insert(std::move(nh));
+  EXPECT_FALSE(res.inserted);
+  EXPECT_EQ(c2.find(7), res.position);
+  EXPECT_EQ(7, res.node.value());
+
+  res = c.insert(std::move(res.node));
+  EXPECT_TRUE(res.inserted);
+  EXPECT_TRUE(res.node.empty());
+  EXPECT_EQ(7, *res.position);
+  expect_eq(c, {1, 3, 4, 7});
+
+  container::iterator it = c.insert(c.end(), c.extract(3));
+  EXPECT_EQ(3, *it);
+  expect_eq(c, {1, 3, 4, 7});
+}
+
+TEST_F(correctness_test, pooled_node_transfer) {
+  pooled_container a;
+  mass_insert(a, {1, 2, 3});
+  pooled_container b(a.get_allocator());
+
+  b.insert(a.extract(2));
+  b.insert(a.extract(a.begin()));
+  expect_eq(a, {3});
+  expect_eq(b, {1, 2});
+}
+
+TEST_F(correctness_test, custom_comparator) {
+  set<int, std::greater<int>> c;
+  mass_insert(c, {3, 1, 4, 1, 5, 9, 2, 6});
+  expect_eq(c, {9, 6, 5, 4, 3, 2, 1});
+  EXPECT_EQ(5, *c.lower_bound(5));
+  EXPECT_EQ(4, *c.upper_bound(5));
+  EXPECT_EQ(c.end(), c.find(7));
+  EXPECT_EQ(1, c.erase(9));
+  EXPECT_EQ(6, *c.begin());
+
+  set<int, std::greater<int>> copy = c;
+  copy.insert(copy.end(), 0);
+  expect_eq(copy, {6, 5, 4, 3, 2, 1, 0});
+}
+
+TEST_F(correctness_test, transparent_lookup) {
+  set<std::string, std::less<>> c;
+  mass_insert(c, {std::string("pear"), std::string("apple"), std::string("plum")});
+
+  std::string_view key = "pear";
+  EXPECT_EQ("pear", *c.find(key));
+  EXPECT_EQ(c.end(), c.find(std::string_view("fig")));
+  EXPECT_EQ("pear", *c.lower_bound(std::string_view("banana")));
+  EXPECT_EQ("plum", *c.upper_bound(key));
+  EXPECT_EQ(1, c.erase(key));
+  EXPECT_EQ(0, c.erase("pear"));
+  expect_eq(c, {std::string("apple"), std::string("plum")});
+}
+
+TEST_F(correctness_test, order_statistics) {
+  ranked_container c;
+  mass_insert(c, {8, 3, 5, 4, 1, 10, 9});
+  c.erase(4);
+
+  EXPECT_EQ(c.begin(), c.nth(0));
+  EXPECT_EQ(5, *c.nth(2));
+  EXPECT_EQ(10, *c.nth(5));
+  EXPECT_EQ(c.end(), c.nth(6));
+
+  EXPECT_EQ(0, c.rank(0));
+  EXPECT_EQ(2, c.rank(4));
+  EXPECT_EQ(2, c.rank(5));
+  EXPECT_EQ(6, c.rank(11));
+
+  EXPECT_EQ(3, c.count_range(3, 9));
+  EXPECT_EQ(6, c.count_range(0, 100));
+  EXPECT_EQ(0, c.count_range(9, 3));
+
+  ranked_container copy = c;
+  copy.extract(8);
+  EXPECT_EQ(9, *copy.nth(3));
+  EXPECT_EQ(8, *c.nth(3));
+}
+
+TEST_F(correctness_test, find_batch) {
+  container c;
+  mass_insert_balanced(c, 100, 2);
+
+  std::vector<element> keys;
+  for (int i = -1; i < 210; i += 3) {
+    keys.push_back(i);
+  }
+  std::vector<container::const_iterator> found(keys.size());
+  std::vector<bool> present(keys.size());
+  EXPECT_EQ(found.end(), c.find_batch(keys.begin(), keys.end(), found.begin()));
+  c.contains_batch(keys.begin(), keys.end(), present.begin());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(c.find(keys[i]), found[i]);
+    EXPECT_EQ(c.find(keys[i]) != c.end(), present[i]);
+  }
+
+  container empty;
+  empty.find_batch(keys.begin(), keys.end(), found.begin());
+  EXPECT_TRUE(std::all_of(found.begin(), found.end(), [&](container::const_iterator it) { return it == empty.end(); }));
+}
+
+TEST_F(correctness_test, find_batch_transparent) {
+  set<std::string, std::less<>> c;
+  mass_insert(c, {std::string("pear"), std::string("apple"), std::string("plum")});
+  std::string_view keys[] = {"plum", "fig", "apple"};
+  bool present[3];
+  c.contains_batch(std::begin(keys), std::end(keys), present);
+  EXPECT_TRUE(present[0]);
+  EXPECT_FALSE(present[1]);
+  EXPECT_TRUE(present[2]);
+}
+
+TEST_F(correctness_test, merge) {
+  container c;
+  mass_insert(c, {1, 3, 5, 7, 9});
+  container other;
+  mass_insert(other, {2, 3, 4, 9, 10});
+  container::const_iterator two = other.find(2);
+  container::const_iterator three = other.find(3);
+
+  c.merge(other);
+  expect_eq(c, {1, 2, 3, 4, 5, 7, 9, 10});
+  expect_eq(other, {3, 9});
+  EXPECT_EQ(two, c.find(2));
+  EXPECT_EQ(three, other.find(3));
+
+  c.merge(container(other));
+  expect_eq(c, {1, 2, 3, 4, 5, 7, 9, 10});
+}
+
+TEST_F(correctness_test, merge_small_into_large) {
+  set<int, std::less<int>, std::allocator<int>, true, true> c;
+  mass_insert_balanced(c, 1000, 2);
+  set<int, std::less<int>, std::allocator<int>, true, true> other;
+  mass_insert(other, {0, 1, 2, 2001, 3001});
+
+  c.merge(other);
+  EXPECT_EQ(1004, c.size());
+  EXPECT_EQ(0, *c.begin());
+  EXPECT_EQ(3001, *c.rbegin());
+  EXPECT_EQ(2001, *c.nth(1002));
+  expect_eq(other, {2});
+}
+
+TEST_F(correctness_test, set_operations) {
+  container a;
+  mass_insert(a, {1, 2, 3, 5, 8, 13});
+  container b;
+  mass_insert(b, {2, 3, 4, 8, 16});
+
+  expect_eq(set_union(a, b), {1, 2, 3, 4, 5, 8, 13, 16});
+  expect_eq(set_intersection(a, b), {2, 3, 8});
+  expect_eq(set_difference(a, b), {1, 5, 13});
+  expect_eq(set_difference(b, a), {4, 16});
+  expect_empty(set_intersection(a, container()));
+  expect_eq(set_union(container(), b), b);
+}
+
+TEST_F(correctness_test, erase_iterator_range) {
+  container c;
+  mass_insert_balanced(c, 100);
+  container::const_iterator kept = c.find(90);
+
+  EXPECT_EQ(c.find(13), c.erase(c.find(10), c.find(13)));
+  EXPECT_EQ(97, c.size());
+  EXPECT_EQ(c.find(80), c.erase(c.find(20), c.find(80)));
+  EXPECT_EQ(37, c.size());
+  EXPECT_EQ(c.end(), c.erase(c.find(95), c.end()));
+  EXPECT_EQ(c.find(3), c.erase(c.begin(), c.find(3)));
+  EXPECT_EQ(90, *kept);
+
+  std::vector<int> expected;
+  for (int i = 3; i < 95; ++i) {
+    if ((i < 10 || i >= 13) && (i < 20 || i >= 80)) {
+      expected.push_back(i);
+    }
+  }
+  expect_eq(c, expected);
+  expect_eq(reverse_view(c), std::vector<int>(expected.rbegin(), expected.rend()));
+
+  EXPECT_EQ(c.end(), c.erase(c.begin(), c.end()));
+  expect_empty(c);
+}
+
+TEST_F(correctness_test, erase_and_count_key_range) {
+  container c;
+  mass_insert_balanced(c, 100, 2);
+  EXPECT_EQ(5, c.count(10, 20));
+  EXPECT_EQ(0, c.count(20, 10));
+  EXPECT_EQ(100, c.count(0, 1000));
+
+  EXPECT_EQ(5, c.erase_range(9, 19));
+  EXPECT_EQ(0, c.count(9, 19));
+  EXPECT_EQ(0, c.erase_range(19, 9));
+  EXPECT_EQ(44, c.erase_range(0, 100));
+  EXPECT_EQ(51, c.size());
+  EXPECT_EQ(100, *c.begin());
+
+  ranked_container r;
+  mass_insert(r, {5, 1, 4, 2, 3, 6, 8, 7});
+  EXPECT_EQ(6, r.erase_range(2, 8));
+  expect_eq(r, {1, 8});
+  EXPECT_EQ(1, r.rank(8));
+
+  threaded_container t;
+  mass_insert(t, {5, 1, 4, 2, 3, 6, 8, 7});
+  EXPECT_EQ(3, t.count(2, 5));
+  EXPECT_EQ(6, t.erase_range(1, 7));
+  expect_eq(reverse_view(t), {8, 7});
+}
+
+TEST_F(correctness_test, erase_range_keeps_balance) {
+  set<int, std::less<int>, std::allocator<int>, true, false> c;
+  mass_insert_balanced(c, 100'000);
+  auto kept = c.find(50'000);
+  std::mt19937 rng(5);
+  for (int i = 0; i < 200; ++i) {
+    int lo = static_cast<int>(rng() % 100'000);
+    int hi = lo + static_cast<int>(rng() % 2000);
+    if (lo <= 50'000 && 50'000 < hi) {
+      continue;
+    }
+    size_t expected = c.count_range(lo, hi);
+    EXPECT_EQ(expected, c.erase_range(lo, hi));
+    tree_shape shape = c.shape();
+    EXPECT_LE(shape.height, 2 * std::bit_width(shape.size + 1));
+    EXPECT_EQ(c.size(), static_cast<size_t>(std::distance(c.begin(), c.end())));
+  }
+  EXPECT_EQ(50'000, *kept);
+  EXPECT_EQ(c.rank(50'000), static_cast<size_t>(std::distance(c.begin(), kept)));
+}
+
+TEST_F(correctness_test, build_parallel) {
+  std::mt19937 rng(7);
+  std::vector<int> input(200'000);
+  for (int& e : input) {
+    e = static_cast<int>(rng() % 150'000);
+  }
+  std::vector<int> expected = input;
+  std::sort(expected.begin(), expected.end());
+  expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+
+  for (size_t threads : {1, 2, 3, 8}) {
+    set<int> c = set<int>::build_parallel(input.begin(), input.end(), threads);
+    expect_eq(c, expected);
+  }
+
+  set<int, std::less<int>, std::allocator<int>, true, true> r =
+      set<int, std::less<int>, std::allocator<int>, true, true>::build_parallel(input.begin(), input.end(), 4);
+  expect_eq(reverse_view(r), std::vector<int>(expected.rbegin(), expected.rend()));
+  EXPECT_EQ(expected[1000], *r.nth(1000));
+  r.insert(-1);
+  r.erase(expected[5]);
+  EXPECT_EQ(expected.size(), r.size());
+
+  std::vector<int> none;
+  expect_empty(set<int>::build_parallel(none.begin(), none.end(), 4));
+}
+
+TEST_F(correctness_test, parallel_allocation_needs_thread_safe_allocator) {
+  using recorded_set = set<int, std::less<int>, recording_allocator<int>>;
+  static_assert(std::allocator_traits<recording_allocator<int>>::is_always_equal::value);
+  static_assert(!thread_safe_allocator<recording_allocator<int>>);
+  static_assert(thread_safe_allocator<std::allocator<int>>);
+
+  std::vector<int> input(200'000);
+  std::iota(input.begin(), input.end(), 0);
+  std::shuffle(input.begin(), input.end(), std::mt19937(3));
+  allocation_threads::ids.clear();
+  recorded_set a = recorded_set::build_parallel(input.begin(), input.end(), 4);
+  EXPECT_EQ(1, allocation_threads::ids.size());
+
+  recorded_set b = recorded_set::build_parallel(input.begin(), input.begin() + 100'000, 1);
+  allocation_threads::ids.clear();
+  recorded_set u = set_union(a, b, 4);
+  recorded_set i = set_intersection(a, b, 4);
+  EXPECT_EQ(1, allocation_threads::ids.size());
+  EXPECT_EQ(input.size(), u.size());
+  EXPECT_EQ(b.size(), i.size());
+}
+
+TEST_F(correctness_test, save_and_load) {
+  temp_file file("save-and-load");
+  set<int> c;
+  mass_insert_balanced(c, 10'000, 3);
+  c.save(file.path);
+
+  set<int> loaded = set<int>::load(file.path);
+  expect_eq(loaded, c);
+  loaded.insert(1);
+  loaded.erase(3);
+  EXPECT_EQ(c.size(), loaded.size());
+
+  frozen_set<int> frozen = frozen_set<int>::load(file.path);
+  expect_eq(frozen, c);
+  frozen.save(file.path);
+  expect_eq(set<int, std::less<int>, std::allocator<int>, true, true>::load(file.path), c);
+
+  set<int>().save(file.path);
+  expect_empty(set<int>::load(file.path));
+}
+
+TEST_F(correctness_test, failed_save_keeps_old_file) {
+  temp_file file("failed-save");
+  set<int> c;
+  mass_insert(c, {1, 2, 3});
+  c.save(file.path);
+
+  // the temporary file cannot be created in place of a directory
+  std::filesystem::path tmp = file.path;
+  tmp += ".tmp";
+  std::filesystem::create_directory(tmp);
+  set<int> other;
+  mass_insert(other, {4, 5});
+  EXPECT_ANY_THROW(other.save(file.path));
+  std::filesystem::remove(tmp);
+
+  expect_eq(set<int>::load(file.path), {1, 2, 3});
+  other.save(file.path);
+  expect_eq(set<int>::load(file.path), {4, 5});
+  EXPECT_FALSE(std::filesystem::exists(tmp));
+}
+
+TEST_F(correctness_test, load_rejects_other_files) {
+  temp_file file("load-rejects");
+  EXPECT_THROW(set<int>::load(file.path), std::system_error);
+
+  set<int> c;
+  mass_insert(c, {1, 2, 3});
+  c.save(file.path);
+  EXPECT_THROW(set<long long>::load(file.path), std::runtime_error);
+  EXPECT_THROW((set<int, std::greater<int>>::load(file.path)), std::runtime_error);
+
+  std::filesystem::resize_file(file.path, std::filesystem::file_size(file.path) - 1);
+  EXPECT_THROW(set<int>::load(file.path), std::runtime_error);
+
+  std::ofstream(file.path) << "not a set";
+  EXPECT_THROW(set<int>::load(file.path), std::runtime_error);
+}
+
+TEST_F(correctness_test, shape) {
+  set<int> c;
+  tree_shape empty = c.shape();
+  EXPECT_EQ(0, empty.size);
+  EXPECT_EQ(0, empty.height);
+  EXPECT_EQ(0, empty.node_bytes);
+
+  mass_insert_balanced(c, 7);
+  tree_shape perfect = c.shape();
+  EXPECT_EQ(7, perfect.size);
+  EXPECT_EQ(3, perfect.height);
+  EXPECT_DOUBLE_EQ(17.0 / 7, perfect.average_depth);
+  EXPECT_LE(7 * (3 * sizeof(void*) + sizeof(int)), perfect.node_bytes);
+
+  for (int i = 8; i < 100'000; ++i) {
+    c.insert(i);
+  }
+  tree_shape grown = c.shape();
+  EXPECT_LE(grown.height, 2 * std::bit_width(grown.size + 1));
+  EXPECT_LT(grown.average_depth, grown.height);
+}
+
+TEST_F(correctness_test, counting_compare) {
+  set<int, counting_compare<>> c;
+  for (int i = 0; i < 1000; ++i) {
+    c.insert(i);
+  }
+  EXPECT_LE(1000, c.key_comp().count());
+
+  c.key_comp().reset();
+  EXPECT_EQ(500, *c.find(500));
+  uint64_t comparisons = c.key_comp().count();
+  EXPECT_LT(0, comparisons);
+  EXPECT_GE(c.shape().height + 1, comparisons);
+
+  set<int, counting_compare<>> copy = c;
+  copy.find(1);
+  EXPECT_LT(comparisons, c.key_comp().count());
+}
+
+TEST_F(correctness_test, parallel_set_operations) {
+  set<int> a;
+  set<int> b;
+  mass_insert_balanced(a, 100'000, 2);
+  mass_insert_balanced(b, 70'000, 3);
+
+  for (size_t threads : {2, 5, 8}) {
+    expect_eq(set_union(a, b, threads), set_union(a, b));
+    expect_eq(set_intersection(a, b, threads), set_intersection(a, b));
+    expect_eq(set_intersection(b, a, threads), set_intersection(a, b));
+  }
+  expect_eq(set_union(a, set<int>(), 4), a);
+}
+
+TEST_F(correctness_test, threaded_iteration) {
+  threaded_container c;
+  mass_insert(c, {8, 3, 5, 4, 1, 10, 9});
+  expect_eq(c, {1, 3, 4, 5, 8, 9, 10});
+  expect_eq(reverse_view(c), {10, 9, 8, 5, 4, 3, 1});
+
+  c.erase(1);
+  c.erase(c.find(10));
+  c.insert(c.end(), 11);
+  c.emplace_hint(c.begin(), 0);
+  expect_eq(c, {0, 3, 4, 5, 8, 9, 11});
+  expect_eq(reverse_view(c), {11, 9, 8, 5, 4, 3, 0});
+  EXPECT_EQ(c.end(), std::next(c.find(11)));
+  EXPECT_EQ(9, *std::prev(c.find(11)));
+
+  threaded_container::node_type nh = c.extract(5);
+  nh.value() = 6;
+  c.insert(std::move(nh));
+  std::vector<element> more = {1, 2, 7};
+  c.insert_sorted(more.begin(), more.end());
+  expect_eq(c, {0, 1, 2, 3, 4, 6, 7, 8, 9, 11});
+  expect_eq(reverse_view(c), {11, 9, 8, 7, 6, 4, 3, 2, 1, 0});
+}
+
+TEST_F(correctness_test, threaded_copy_move_swap) {
+  threaded_container c;
+  mass_insert(c, {2, 1, 3});
+  threaded_container copy = c;
+  copy.insert(4);
+  expect_eq(reverse_view(copy), {4, 3, 2, 1});
+
+  threaded_container moved = std::move(copy);
+  expect_empty(copy);
+  expect_eq(reverse_view(moved), {4, 3, 2, 1});
+
+  swap(c, moved);
+  expect_eq(reverse_view(c), {4, 3, 2, 1});
+  expect_eq(reverse_view(moved), {3, 2, 1});
+
+  moved = std::move(c);
+  expect_eq(reverse_view(moved), {4, 3, 2, 1});
+  moved.clear();
+  expect_empty(moved);
+  moved.insert(5);
+  expect_eq(reverse_view(moved), {5});
+}
+
 TEST_F(exception_safety_test, non_throwing_default_ctor) {
   faulty_run([] {
     try {
@@ -916,6 +1617,96 @@ TEST_F(exception_safety_test, copy_assignment) {
   });
 }
 
+TEST_F(exception_safety_test, sorted_unique_ctor) {
+  faulty_run([] {
+    std::vector<element> elems = {1, 2, 3, 4, 5};
+    container c(sorted_unique, elems.begin(), elems.end());
+    expect_eq(c, {1, 2, 3, 4, 5});
+  });
+}
+
+TEST_F(exception_safety_test, insert_sorted) {
+  faulty_run([] {
+    container c;
+    mass_insert(c, {3, 1, 5});
+
+    std::vector<element> elems = {0, 2, 4, 6};
+    try {
+      c.insert_sorted(elems.begin(), elems.end());
+    } catch (...) {
+      fault_injection_disable dg;
+      EXPECT_TRUE(std::is_sorted(c.begin(), c.end()));
+      EXPECT_EQ(c.end(), c.find(7));
+      EXPECT_NE(c.end(), c.find(3));
+      throw;
+    }
+    expect_eq(c, {0, 1, 2, 3, 4, 5, 6});
+  });
+}
+
+TEST_F(exception_safety_test, merge) {
+  faulty_run([] {
+    container c;
+    mass_insert(c, {1, 3, 5, 7});
+    container other;
+    mass_insert(other, {2, 3, 6, 8});
+    try {
+      c.merge(other);
+    } catch (...) {
+      fault_injection_disable dg;
+      EXPECT_EQ(8, c.size() + other.size());
+      EXPECT_TRUE(std::is_sorted(c.begin(), c.end()));
+      EXPECT_TRUE(std::is_sorted(other.begin(), other.end()));
+      throw;
+    }
+    expect_eq(c, {1, 2, 3, 5, 6, 7, 8});
+    expect_eq(other, {3});
+  });
+}
+
+TEST_F(exception_safety_test, set_union) {
+  faulty_run([] {
+    container a;
+    mass_insert(a, {1, 3, 5});
+    container b;
+    mass_insert(b, {2, 3, 4});
+    strong_exception_safety_guard sg_a(a);
+    strong_exception_safety_guard sg_b(b);
+    container c = set_union(a, b);
+    expect_eq(c, {1, 2, 3, 4, 5});
+  });
+}
+
+TEST_F(exception_safety_test, erase_range) {
+  faulty_run([] {
+    container c;
+    mass_insert(c, {3, 2, 4, 1, 7, 6, 5});
+
+    strong_exception_safety_guard sg(c);
+    EXPECT_EQ(3, c.erase_range(2, 5));
+    expect_eq(c, {1, 5, 6, 7});
+  });
+}
+
+TEST_F(exception_safety_test, build_parallel) {
+  faulty_run([] {
+    std::vector<element> input = {5, 3, 5, 1, 4, 1};
+    container c = container::build_parallel(input.begin(), input.end(), 2);
+    expect_eq(c, {1, 3, 4, 5});
+  });
+}
+
+TEST_F(exception_safety_test, load) {
+  temp_file file("exception-safety-load");
+  set<int> c;
+  mass_insert(c, {5, 3, 1, 4});
+  c.save(file.path);
+  faulty_run([&] {
+    set<int> loaded = set<int>::load(file.path);
+    expect_eq(loaded, {1, 3, 4, 5});
+  });
+}
+
 TEST_F(exception_safety_test, insert) {
   faulty_run([] {
     container c;
@@ -927,6 +1718,55 @@ TEST_F(exception_safety_test, insert) {
   });
 }
 
+TEST_F(exception_safety_test, insert_with_hint) {
+  faulty_run([] {
+    container c;
+    mass_insert(c, {3, 2, 4, 1});
+
+    container::const_iterator hint = c.end();
+    strong_exception_safety_guard sg(c);
+    c.insert(hint, 5);
+    expect_eq(c, {1, 2, 3, 4, 5});
+  });
+}
+
+TEST_F(exception_safety_test, emplace_hint) {
+  faulty_run([] {
+    container c;
+    mass_insert(c, {3, 2, 4, 1});
+
+    container::const_iterator hint = c.begin();
+    strong_exception_safety_guard sg(c);
+    c.emplace_hint(hint, 0);
+    expect_eq(c, {0, 1, 2, 3, 4});
+  });
+}
+
+TEST_F(exception_safety_test, emplace) {
+  faulty_run([] {
+    container c;
+    mass_insert(c, {3, 2, 4, 1});
+
+    strong_exception_safety_guard sg(c);
+    c.emplace(5);
+    expect_eq(c, {1, 2, 3, 4, 5});
+  });
+}
+
+TEST_F(exception_safety_test, insert_node) {
+  faulty_run([] {
+    container c;
+    mass_insert(c, {3, 2, 4, 1});
+    container c2;
+    mass_insert(c2, {5});
+    container::node_type nh = c2.extract(c2.begin());
+
+    strong_exception_safety_guard sg(c);
+    c.insert(std::move(nh));
+    expect_eq(c, {1, 2, 3, 4, 5});
+  });
+}
+
 TEST_F(exception_safety_test, erase_1) {
   faulty_run([] {
     container c;
@@ -991,6 +1831,233 @@ TEST_F(performance_test, lower_bound) {
   }
 }
 
+TEST_F(performance_test, insert_ascending) {
+  constexpr int N = 100'000;
+  constexpr size_t K = 100'000;
+
+  container c;
+  for (int i = 0; i < N; ++i) {
+    c.insert(i);
+  }
+
+  for (size_t i = 0; i < K; ++i) {
+    EXPECT_EQ(std::prev(c.end()), c.find(N - 1));
+  }
+}
+
+TEST_F(performance_test, erase_ascending) {
+  constexpr int N = 100'000;
+
+  container c;
+  for (int i = N; i > 0; --i) {
+    c.insert(i);
+  }
+  for (int i = 1; i < N; ++i) {
+    c.erase(c.begin());
+    EXPECT_EQ(N, *c.lower_bound(N));
+  }
+  expect_eq(c, {N});
+}
+
+TEST_F(performance_test, copy_and_clear) {
+  constexpr size_t N = 100'000;
+  constexpr size_t K = 5;
+
+  container c;
+  mass_insert_balanced(c, N);
+
+  for (size_t i = 0; i < K; ++i) {
+    container copy = c;
+    EXPECT_EQ(N, copy.size());
+    EXPECT_EQ(copy.begin(), copy.find(1));
+    copy.clear();
+    expect_empty(copy);
+  }
+}
+
+TEST_F(performance_test, pooled_copy) {
+  constexpr size_t N = 100'000;
+  constexpr size_t K = 5;
+
+  set<int, std::less<int>, pool_allocator<int>> c;
+  mass_insert_balanced(c, N);
+
+  for (size_t i = 0; i < K; ++i) {
+    set<int, std::less<int>, pool_allocator<int>> copy = c;
+    EXPECT_EQ(N, copy.size());
+    EXPECT_EQ(copy.begin(), copy.find(1));
+    EXPECT_EQ(std::prev(copy.end()), copy.find(static_cast<int>(N)));
+  }
+}
+
+TEST_F(performance_test, pooled_insert_and_clear) {
+  constexpr size_t N = 100'000;
+  constexpr size_t K = 5;
+
+  set<int, std::less<int>, pool_allocator<int>> c;
+  for (size_t i = 0; i < K; ++i) {
+    mass_insert_balanced(c, N);
+    EXPECT_EQ(N, c.size());
+    c.clear();
+    expect_empty(c);
+  }
+}
+
+TEST_F(performance_test, insert_with_hint) {
+  constexpr int N = 1'000'000;
+
+  set<int> c;
+  for (int i = 0; i < N; ++i) {
+    c.insert(c.end(), i);
+  }
+  set<int>::iterator it = c.end();
+  for (int i = N; i < 2 * N; ++i) {
+    it = c.insert(it, i);
+  }
+  EXPECT_EQ(2 * N, c.size());
+  EXPECT_EQ(2 * N - 1, *it);
+}
+
+TEST_F(performance_test, sorted_build) {
+  constexpr int N = 1'000'000;
+
+  std::vector<int> elems(N);
+  std::iota(elems.begin(), elems.end(), 0);
+  set<int> c(sorted_unique, elems.begin(), elems.end());
+  EXPECT_EQ(N, c.size());
+
+  for (int& e : elems) {
+    e += N;
+  }
+  c.insert_sorted(elems.begin(), elems.end());
+  EXPECT_EQ(2 * N, c.size());
+  EXPECT_EQ(2 * N - 1, *c.lower_bound(2 * N - 1));
+}
+
+TEST_F(performance_test, move) {
+  constexpr size_t N = 100'000;
+  constexpr size_t K = 1'000'000;
+
+  container c1;
+  mass_insert_balanced(c1, N);
+
+  for (size_t i = 0; i < K; ++i) {
+    container c2 = std::move(c1);
+    c1 = std::move(c2);
+  }
+  EXPECT_EQ(N, c1.size());
+}
+
+TEST_F(performance_test, order_statistics) {
+  constexpr size_t N = 100'000;
+  constexpr size_t K = 1'000'000;
+
+  set<int, std::less<int>, std::allocator<int>, true> c;
+  mass_insert_balanced(c, N);
+
+  for (size_t i = 0; i < K; ++i) {
+    size_t k = i % N;
+    EXPECT_EQ(k + 1, *c.nth(k));
+    EXPECT_EQ(k, c.rank(static_cast<int>(k + 1)));
+  }
+}
+
+TEST_F(performance_test, find_batch) {
+  constexpr size_t N = 1'000'000;
+  constexpr size_t K = 4'000'000;
+  constexpr size_t BATCH = 256;
+
+  std::mt19937 rng(1);
+  set<int> c;
+  for (size_t i = 0; i < N; ++i) {
+    c.insert(static_cast<int>(rng() % (4 * N)));
+  }
+  std::vector<int> keys(K);
+  for (int& key : keys) {
+    key = static_cast<int>(rng() % (4 * N));
+  }
+  std::vector<bool> present(K);
+  for (size_t i = 0; i < K; i += BATCH) {
+    c.contains_batch(keys.begin() + i, keys.begin() + i + BATCH, present.begin() + i);
+  }
+  EXPECT_LE(std::count(present.begin(), present.end(), true), K);
+}
+
+TEST_F(performance_test, merge_and_set_operations) {
+  constexpr size_t N = 1'000'000;
+
+  set<int> a;
+  set<int> b;
+  mass_insert_balanced(a, N, 2);
+  mass_insert_balanced(b, N, 3);
+
+  EXPECT_EQ(N / 3, set_intersection(a, b).size());
+  EXPECT_EQ(N - N / 3, set_difference(a, b).size());
+  set<int> u = set_union(a, b);
+  a.merge(b);
+  EXPECT_EQ(u.size(), a.size());
+  EXPECT_EQ(N / 3, b.size());
+}
+
+TEST_F(performance_test, erase_range) {
+  constexpr size_t N = 1'000'000;
+  constexpr int STEP = 1000;
+
+  set<int> c;
+  mass_insert_balanced(c, N);
+  // expire entries below a moving watermark, then drop the bulk at once
+  for (int lo = 1; lo < static_cast<int>(N / 2); lo += STEP) {
+    EXPECT_EQ(STEP, c.erase_range(lo, lo + STEP));
+  }
+  c.erase_range(0, static_cast<int>(N));
+  EXPECT_EQ(1, c.size());
+}
+
+TEST_F(performance_test, build_parallel) {
+  constexpr size_t N = 4'000'000;
+
+  std::mt19937 rng(1);
+  std::vector<int> input(N);
+  for (int& e : input) {
+    e = static_cast<int>(rng());
+  }
+  set<int> a = set<int>::build_parallel(input.begin(), input.end());
+  set<int> b = set<int>::build_parallel(input.begin(), input.begin() + N / 2);
+  EXPECT_EQ(a.size(), set_union(a, b, 0).size());
+  EXPECT_EQ(b.size(), set_intersection(a, b, 0).size());
+}
+
+TEST_F(performance_test, save_and_load) {
+  constexpr size_t N = 4'000'000;
+
+  temp_file file("performance-save-and-load");
+  set<int> c;
+  mass_insert_balanced(c, N);
+  c.save(file.path);
+  c.clear();
+  c = set<int>::load(file.path);
+  EXPECT_EQ(N, c.size());
+  EXPECT_EQ(N, frozen_set<int>::load(file.path).size());
+}
+
+TEST_F(performance_test, threaded_iteration) {
+  constexpr size_t N = 1'000'000;
+  constexpr size_t K = 20;
+
+  set<int, std::less<int>, std::allocator<int>, false, true> c;
+  mass_insert_balanced(c, N);
+
+  for (size_t i = 0; i < K; ++i) {
+    int expected = 0;
+    for (int e : c) {
+      EXPECT_EQ(++expected, e);
+    }
+    for (auto it = c.rbegin(); it != c.rend(); ++it) {
+      EXPECT_EQ(expected--, *it);
+    }
+  }
+}
+
 TEST_F(performance_test, swap) {
   constexpr size_t N = 100'000;
   constexpr size_t K = 1'000'000;